@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "util/bitset.hpp"
+#include "util/io.hpp"
+
+namespace file {
+
+struct tile {
+	enum flag : uint16_t {
+		active = 1 << 0,
+		wire = 1 << 1,
+		wire2 = 1 << 2,
+		wire3 = 1 << 3,
+		wire4 = 1 << 4,
+		actuator = 1 << 5,
+		inactive = 1 << 6,
+		half_brick = 1 << 7,
+		invisible_block = 1 << 8,
+		invisible_wall = 1 << 9,
+		fullbright_block = 1 << 10,
+		fullbright_wall = 1 << 11,
+	};
+
+	enum liquid_kind : uint8_t {
+		water,
+		lava,
+		honey,
+		shimmer,
+	};
+
+	uint16_t type = 0;
+	uint16_t wall = 0;
+	// -1 for tiles whose frame isn't important, the client works it out
+	int16_t frame_x = -1;
+	int16_t frame_y = -1;
+	uint16_t flags = 0;
+	uint8_t liquid = 0;
+	uint8_t liquid_type = water;
+	uint8_t color = 0;
+	uint8_t wall_color = 0;
+	uint8_t slope = 0;
+
+	bool has(flag f) const { return flags & f; }
+
+	void set(flag f, bool on)
+	{
+		if (on)
+			flags |= f;
+		else
+			flags &= ~f;
+	}
+
+	bool operator==(const tile&) const = default;
+};
+
+// Per tile type, whether its frame is stored along with it. Worlds carry
+// the table in their header, see file::world::importance().
+using tile_importance = bitset<0>;
+
+inline bool frame_important(const tile_importance& importance, uint16_t type)
+{
+	return type / 8 < importance.size() && importance[type];
+}
+
+// Reads one tile in the run length encoded format .wld files and
+// send_tile_data sections share (1.4.4 and later). Returns how many
+// copies of it follow.
+template <class I>
+uint16_t read_tile(io::serialized_io<I>& rd, tile& t, const tile_importance& importance)
+{
+	uint8_t h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+	rd.read(h1);
+	if (h1 & 1) {
+		rd.read(h2);
+		if (h2 & 1) {
+			rd.read(h3);
+			if (h3 & 1) {
+				rd.read(h4);
+			}
+		}
+	}
+
+	t = tile {};
+	if (h1 & 2) {
+		t.flags |= tile::active;
+		if (h1 & 32) {
+			rd.read(t.type);
+		} else {
+			uint8_t type;
+			rd.read(type);
+			t.type = type;
+		}
+		if (frame_important(importance, t.type)) {
+			rd.read(t.frame_x);
+			rd.read(t.frame_y);
+		}
+		if (h3 & 8) {
+			rd.read(t.color);
+		}
+	}
+
+	if (h1 & 4) {
+		uint8_t wall;
+		rd.read(wall);
+		t.wall = wall;
+		if (h3 & 16) {
+			rd.read(t.wall_color);
+		}
+	}
+
+	if (auto liquid = (h1 & 24) >> 3; liquid != 0) {
+		rd.read(t.liquid);
+		t.liquid_type = (h3 & 128) ? tile::shimmer : liquid - 1;
+	}
+
+	if (h2 > 1) {
+		t.set(tile::wire, h2 & 2);
+		t.set(tile::wire2, h2 & 4);
+		t.set(tile::wire3, h2 & 8);
+		auto slope = (h2 & 112) >> 4;
+		t.set(tile::half_brick, slope == 1);
+		t.slope = slope > 1 ? slope - 1 : 0;
+	}
+
+	if (h3 > 1) {
+		t.set(tile::actuator, h3 & 2);
+		t.set(tile::inactive, h3 & 4);
+		t.set(tile::wire4, h3 & 32);
+		if (h3 & 64) {
+			uint8_t high;
+			rd.read(high);
+			t.wall |= high << 8;
+		}
+	}
+
+	if (h4 > 1) {
+		t.set(tile::invisible_block, h4 & 2);
+		t.set(tile::invisible_wall, h4 & 4);
+		t.set(tile::fullbright_block, h4 & 8);
+		t.set(tile::fullbright_wall, h4 & 16);
+	}
+
+	switch ((h1 & 192) >> 6) {
+	case 0:
+		return 0;
+	case 1: {
+		uint8_t repeat;
+		rd.read(repeat);
+		return repeat;
+	}
+	default: {
+		uint16_t repeat;
+		rd.read(repeat);
+		return repeat;
+	}
+	}
+}
+
+// Writes `t` so that read_tile() reads it back, followed by `repeat` copies.
+// Colors of absent blocks and walls, and the liquid type of no liquid, are
+// left out like the game does.
+template <class I>
+ssize_t write_tile(io::serialized_io<I>& wr, const tile& t, const tile_importance& importance, uint16_t repeat)
+{
+	uint8_t h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+	auto active = t.has(tile::active);
+	if (active) {
+		h1 |= 2;
+		h1 |= t.type > 255 ? 32 : 0;
+		h3 |= t.color ? 8 : 0;
+	}
+	if (t.wall) {
+		h1 |= 4;
+		h3 |= t.wall_color ? 16 : 0;
+		h3 |= t.wall > 255 ? 64 : 0;
+	}
+	if (t.liquid) {
+		if (t.liquid_type == tile::shimmer) {
+			h1 |= 8;
+			h3 |= 128;
+		} else {
+			h1 |= (t.liquid_type + 1) << 3;
+		}
+	}
+
+	h2 |= t.has(tile::wire) ? 2 : 0;
+	h2 |= t.has(tile::wire2) ? 4 : 0;
+	h2 |= t.has(tile::wire3) ? 8 : 0;
+	if (t.has(tile::half_brick)) {
+		h2 |= 1 << 4;
+	} else if (t.slope) {
+		h2 |= (t.slope + 1) << 4;
+	}
+
+	h3 |= t.has(tile::actuator) ? 2 : 0;
+	h3 |= t.has(tile::inactive) ? 4 : 0;
+	h3 |= t.has(tile::wire4) ? 32 : 0;
+
+	h4 |= t.has(tile::invisible_block) ? 2 : 0;
+	h4 |= t.has(tile::invisible_wall) ? 4 : 0;
+	h4 |= t.has(tile::fullbright_block) ? 8 : 0;
+	h4 |= t.has(tile::fullbright_wall) ? 16 : 0;
+
+	h3 |= h4 ? 1 : 0;
+	h2 |= h3 ? 1 : 0;
+	h1 |= h2 ? 1 : 0;
+	h1 |= repeat > 255 ? 128 : repeat > 0 ? 64 : 0;
+
+	auto bytes = wr.write(h1);
+	if (h1 & 1) {
+		bytes += wr.write(h2);
+		if (h2 & 1) {
+			bytes += wr.write(h3);
+			if (h3 & 1) {
+				bytes += wr.write(h4);
+			}
+		}
+	}
+
+	if (active) {
+		bytes += t.type > 255 ? wr.write(t.type) : wr.write(uint8_t(t.type));
+		if (frame_important(importance, t.type)) {
+			bytes += wr.write(t.frame_x);
+			bytes += wr.write(t.frame_y);
+		}
+		if (h3 & 8) {
+			bytes += wr.write(t.color);
+		}
+	}
+	if (t.wall) {
+		bytes += wr.write(uint8_t(t.wall));
+		if (h3 & 16) {
+			bytes += wr.write(t.wall_color);
+		}
+	}
+	if (t.liquid) {
+		bytes += wr.write(t.liquid);
+	}
+	if (h3 & 64) {
+		bytes += wr.write(uint8_t(t.wall >> 8));
+	}
+
+	if (repeat > 255) {
+		bytes += wr.write(repeat);
+	} else if (repeat > 0) {
+		bytes += wr.write(uint8_t(repeat));
+	}
+	return bytes;
+}
+
+// A width x height grid of tiles, stored column by column like .wld files.
+class tiles {
+	int32_t w = 0;
+	int32_t h = 0;
+	std::vector<tile> grid;
+
+public:
+	tiles() = default;
+
+	tiles(int32_t width, int32_t height)
+	    : w(width)
+	    , h(height)
+	{
+		if (width < 0 || height < 0) {
+			throw std::runtime_error("bad world size");
+		}
+		grid.resize(size_t(width) * height);
+	}
+
+	int32_t width() const { return w; }
+	int32_t height() const { return h; }
+
+	bool contains(int32_t x, int32_t y) const { return x >= 0 && y >= 0 && x < w && y < h; }
+
+	tile& at(int32_t x, int32_t y) { return grid[size_t(x) * h + y]; }
+	const tile& at(int32_t x, int32_t y) const { return grid[size_t(x) * h + y]; }
+
+	// The tiles of the given rectangle, clipped to the grid.
+	tiles region(int32_t x, int32_t y, int32_t width, int32_t height) const
+	{
+		auto x0 = std::max(x, 0), y0 = std::max(y, 0);
+		auto x1 = std::min(x + width, w), y1 = std::min(y + height, h);
+		tiles out(std::max(x1 - x0, 0), std::max(y1 - y0, 0));
+		for (auto i = x0; i < x1; i++) {
+			for (auto j = y0; j < y1; j++) {
+				out.at(i - x0, j - y0) = at(i, j);
+			}
+		}
+		return out;
+	}
+};
+
+// Writes `grid` column by column like .wld files, runs of equal tiles as
+// one tile and a repeat count.
+template <class I>
+ssize_t write_tiles(io::serialized_io<I>& wr, const tiles& grid, const tile_importance& importance)
+{
+	ssize_t bytes = 0;
+	for (int32_t x = 0; x < grid.width(); x++) {
+		for (int32_t y = 0; y < grid.height();) {
+			auto& t = grid.at(x, y);
+			uint16_t repeat = 0;
+			while (y + repeat + 1 < grid.height() && repeat < UINT16_MAX && grid.at(x, y + repeat + 1) == t) {
+				repeat++;
+			}
+			bytes += write_tile(wr, t, importance, repeat);
+			y += repeat + 1;
+		}
+	}
+	return bytes;
+}
+
+}
\ No newline at end of file
@@ -1,16 +1,22 @@
 #pragma once
 
+#include <array>
+#include <cerrno>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <fcntl.h>
 #include <filesystem>
 #include <stdexcept>
 #include <string>
+#include <unistd.h>
 #include <vector>
 
 #include "file/metadata.hpp"
+#include "file/tile.hpp"
 #include "util/bitset.hpp"
 #include "util/io.hpp"
+#include "util/profile.hpp"
 #include "version.hpp"
 
 namespace file {
@@ -70,11 +76,64 @@ class world {
 		CreativePowersEnd,
 	};
 
+	// the start of the header section, as far as the tiles need it
+	struct properties {
+		std::string name;
+		int32_t id;
+		int32_t width;
+		int32_t height;
+
+		ssize_t read(io::serialized_file f, int32_t version)
+		{
+			auto bytes = f.read(name);
+			if (version >= 179) {
+				if (version == 179) {
+					int32_t seed;
+					bytes += f.read(seed);
+				} else {
+					std::string seed;
+					bytes += f.read(seed);
+				}
+				uint64_t generator_version;
+				bytes += f.read(generator_version);
+			}
+			if (version >= 181) {
+				std::array<uint8_t, 16> guid;
+				bytes += f.read(guid);
+			}
+			bytes += f.read(id);
+
+			std::array<int32_t, 4> bounds;
+			bytes += f.read(bounds);
+			bytes += f.read(height);
+			bytes += f.read(width);
+			return bytes;
+		}
+
+		template <class I>
+		ssize_t write(io::serialized_io<I>& f) const
+		{
+			auto bytes = f.write(name);
+			bytes += f.write(std::to_string(id));
+			bytes += f.write(uint64_t(0));
+			bytes += f.write(std::array<uint8_t, 16> {});
+			bytes += f.write(id);
+			bytes += f.write(std::array<int32_t, 4> { 0, width * 16, 0, height * 16 });
+			bytes += f.write(height);
+			bytes += f.write(width);
+			return bytes;
+		}
+	};
+
+	std::string filename;
 	header hdr;
+	properties props;
 
 public:
 	world(std::string filename)
+	    : filename(filename)
 	{
+		profile::scope p("world.header");
 		if (!std::filesystem::exists(filename)) {
 			throw std::runtime_error("file not found");
 		}
@@ -84,6 +143,110 @@ public:
 		if (offset != hdr.positions[file_positions::FileHeaderEnd]) {
 			throw std::runtime_error("currupted file!");
 		}
+		props.read(rw, hdr.version);
+		rw.device().close();
+	}
+
+	const std::string& name() const { return props.name; }
+	int32_t id() const { return props.id; }
+	int32_t width() const { return props.width; }
+	int32_t height() const { return props.height; }
+	int32_t version() const { return hdr.version; }
+
+	const tile_importance& importance() const { return hdr.importance; }
+
+	// Reads the whole tile section, e.g. to seed a net::world_mirror.
+	tiles load_tiles() const
+	{
+		profile::scope p("world.load_tiles");
+		if (hdr.version < 269) {
+			throw std::runtime_error("unsupported world version");
+		}
+
+		auto begin = hdr.positions[file_positions::HeaderEnd];
+		auto end = hdr.positions[file_positions::WorldTilesEnd];
+		if (begin < 0 || end < begin) {
+			throw std::runtime_error("currupted file!");
+		}
+
+		std::vector<uint8_t> data(end - begin);
+		auto fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			throw std::runtime_error(strerror(errno));
+		}
+		size_t got = 0;
+		while (got < data.size()) {
+			auto bytes = pread(fd, data.data() + got, data.size() - got, begin + got);
+			if (bytes <= 0) {
+				::close(fd);
+				throw std::runtime_error(bytes < 0 ? strerror(errno) : "currupted file!");
+			}
+			got += bytes;
+		}
+		::close(fd);
+
+		tiles out(props.width, props.height);
+		auto rd = io::serialized_io(io::buffered_io { data });
+		for (int32_t x = 0; x < props.width; x++) {
+			for (int32_t y = 0; y < props.height; y++) {
+				auto& t = out.at(x, y);
+				auto repeat = read_tile(rd, t, hdr.importance);
+				for (; repeat > 0 && y + 1 < props.height; repeat--) {
+					out.at(x, ++y) = t;
+				}
+			}
+			if (rd.device().truncated()) {
+				throw std::runtime_error("currupted file!");
+			}
+		}
+		return out;
+	}
+
+	// Writes a world of the current version the constructor and
+	// load_tiles() read back: the file header, the start of the header
+	// section and the tiles. The rest of the sections are left empty, so
+	// it's for tools and benchmarks; Terraria won't load it.
+	static void save(const std::string& filename, const std::string& name, int32_t id, const tiles& grid, const tile_importance& importance)
+	{
+		profile::scope p("world.save");
+		properties props { name, id, grid.width(), grid.height() };
+		std::vector<uint8_t> body;
+		auto wr = io::serialized_io(io::buffered_io { body });
+		auto props_size = props.write(wr);
+		auto tiles_size = write_tiles(wr, grid, importance);
+
+		std::vector<uint8_t> data;
+		auto hw = io::serialized_io(io::buffered_io { data });
+		// version, metadata, position count, positions, importance count
+		int32_t header_size = 4 + metadata::size + 2 + 4 * (CreativePowersEnd + 1) + 2 + importance.size();
+		std::vector<int32_t> positions(CreativePowersEnd + 1, header_size + props_size + tiles_size);
+		positions[FileHeaderEnd] = header_size;
+		positions[HeaderEnd] = header_size + props_size;
+
+		hw.write(int32_t(terraria_version));
+		hw.write(metadata::magic | uint64_t(metadata::filetype::World) << 56);
+		hw.write(uint32_t(1));
+		hw.write(uint64_t(0));
+		hw.write(int16_t(positions.size()));
+		hw.write(positions);
+		hw.write(int16_t(importance.size() * 8));
+		hw.write(importance);
+		data.insert(data.end(), body.begin(), body.end());
+
+		auto fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			throw std::runtime_error(strerror(errno));
+		}
+		size_t done = 0;
+		while (done < data.size()) {
+			auto bytes = ::write(fd, data.data() + done, data.size() - done);
+			if (bytes < 0) {
+				::close(fd);
+				throw std::runtime_error(strerror(errno));
+			}
+			done += bytes;
+		}
+		::close(fd);
 	}
 };
 
@@ -3,9 +3,11 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <coroutine>
 #include <cstring>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -19,34 +21,122 @@
 #include <unistd.h>
 
 #include "net/conn.hpp"
+#include "net/event_loop.hpp"
+#include "net/socket_options.hpp"
 
 namespace net {
 
 class client {
 	struct sockaddr_in server_address {};
+	socket_options options;
 
 public:
-	client(std::string ip, int port)
+	client(std::string ip, int port, socket_options options = {})
+	    : options(options)
 	{
 		server_address.sin_family = AF_INET;
 		inet_pton(AF_INET, ip.c_str(), &server_address.sin_addr);
 		server_address.sin_port = htons(port);
 	}
 
-	conn connect()
+	template <class I = io::file_io, class... Args>
+	basic_conn<I> connect(Args... args)
 	{
 		int sock_fd;
 
-		sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+		sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 		if (sock_fd < 0)
 			throw std::runtime_error(strerror(errno));
 
+		try {
+			options.apply(sock_fd);
+		} catch (std::runtime_error&) {
+			::close(sock_fd);
+			throw;
+		}
+
 		auto err = ::connect(sock_fd, (struct sockaddr*)&server_address,
 		    sizeof(server_address));
-		if (err < 0)
-			throw std::runtime_error(strerror(errno));
+		if (err < 0) {
+			auto e = errno;
+			::close(sock_fd);
+			throw std::runtime_error(strerror(e));
+		}
+
+		return basic_conn<I> { I(sock_fd, args...), server_address, sizeof(server_address) };
+	}
+
+	// co_await client.connect_async(loop) connects without blocking the
+	// thread running `loop`, see net/task.hpp. Throws like connect(), and
+	// gives up after basic_conn::default_timeout. The socket is non-blocking.
+	template <class I = io::file_io, class... Args>
+	auto connect_async(event_loop& loop, Args... args)
+	{
+		struct awaiter {
+			event_loop& loop;
+			sockaddr_in address;
+			socket_options options;
+			std::tuple<Args...> args;
+			int fd = -1;
+			int error = 0;
+			event_loop::timer t {};
+
+			bool await_ready()
+			{
+				fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				if (fd < 0) {
+					error = errno;
+					return true;
+				}
+
+				try {
+					options.apply(fd);
+				} catch (std::runtime_error&) {
+					error = errno;
+					return true;
+				}
+
+				if (::connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+					return true;
+				}
+				error = errno == EINPROGRESS ? 0 : errno;
+				return error != 0;
+			}
+
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				loop.add(fd, EPOLLOUT | EPOLLET, [this, h](uint32_t) {
+					socklen_t size = sizeof(error);
+					if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0) {
+						error = errno;
+					}
+					finish(h);
+				});
+				t = loop.add_timer(basic_conn<I>::default_timeout, [this, h] {
+					error = ETIMEDOUT;
+					finish(h);
+				});
+			}
+
+			void finish(std::coroutine_handle<> h)
+			{
+				loop.remove(fd);
+				loop.cancel_timer(t);
+				h.resume();
+			}
 
-		return conn { sock_fd, server_address, sizeof(server_address) };
+			basic_conn<I> await_resume()
+			{
+				if (error != 0) {
+					if (fd >= 0) {
+						::close(fd);
+					}
+					throw std::runtime_error(strerror(error));
+				}
+				return std::apply([this](auto... a) { return basic_conn<I> { I(fd, a...), address, sizeof(address) }; }, args);
+			}
+		};
+		return awaiter { loop, server_address, options, { args... } };
 	}
 };
 };
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "util/bitset.hpp"
+
+namespace net {
+
+// Holds state frames until the next tick, keeping only the newest one per
+// (packet id, client id), the first payload byte. Frames leave in the order
+// their key was first seen. See packet::coalesced_ids().
+class coalescer {
+	struct frame {
+		uint8_t id;
+		std::vector<uint8_t> payload;
+	};
+
+	bitset<256> ids;
+	std::vector<frame> frames;
+	std::unordered_map<uint16_t, size_t> index;
+	size_t replaced = 0;
+
+public:
+	coalescer(bitset<256> ids)
+	    : ids(ids)
+	{
+	}
+
+	// True if the frame is held for the next drain().
+	bool hold(uint8_t id, std::span<const uint8_t> payload)
+	{
+		if (!ids[id] || payload.empty()) {
+			return false;
+		}
+
+		auto [it, inserted] = index.try_emplace(uint16_t(id) << 8 | payload[0], frames.size());
+		if (inserted) {
+			frames.push_back({ id, { payload.begin(), payload.end() } });
+		} else {
+			frames[it->second].payload.assign(payload.begin(), payload.end());
+			replaced++;
+		}
+		return true;
+	}
+
+	bool empty() const { return frames.empty(); }
+
+	// Calls `send(id, payload)` for every held frame.
+	template <class F>
+	void drain(F send)
+	{
+		auto out = std::move(frames);
+		frames.clear();
+		index.clear();
+		for (auto& f : out) {
+			send(f.id, std::span(f.payload));
+		}
+	}
+
+	size_t replaced_frames() const { return replaced; }
+};
+
+}
\ No newline at end of file
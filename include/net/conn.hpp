@@ -1,19 +1,50 @@
 #pragma once
 
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
 #include <cstdint>
+#include <deque>
 #include <functional>
-#include <map>
+#include <memory>
+#include <optional>
 #include <span>
+#include <string>
 #include <vector>
 
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
 
+#include "net/coalescer.hpp"
+#include "net/dedup_filter.hpp"
+#include "net/event_loop.hpp"
+#include "net/frame_queue.hpp"
+#include "net/interest_filter.hpp"
+#include "net/layout.hpp"
 #include "net/packet.hpp"
+#include "net/packet_stream.hpp"
+#include "net/registry.hpp"
 #include "util/io.hpp"
+#include "util/profile.hpp"
 
 namespace net {
-class conn {
-	io::serialized_io<io::file_io> rw;
+
+// thrown into a coroutine whose expect() ran out of time
+struct timed_out {};
+
+// When send_packet() hits the socket.
+enum class flush_mode {
+	// at the end of the loop's current batch of events, right away without a loop
+	latency,
+	// once per tick or when a write's worth of frames piled up
+	throughput,
+};
+
+template <class I>
+class basic_conn {
+	io::serialized_io<I> rw;
 
 	sockaddr_in conn_addr;
 	socklen_t conn_addr_size;
@@ -21,7 +52,69 @@ class conn {
 	using handler = std::function<bool(std::span<uint8_t>)>;
 	using handler_list = std::vector<handler>;
 	std::array<handler_list, 256> handlers;
-	std::map<uint16_t, handler_list> netmodule_handlers;
+	std::array<handler_list, packet::max_netmodules> netmodule_handlers;
+
+	static constexpr size_t read_size = 16 * 1024;
+	static constexpr size_t write_size = 64 * 1024;
+
+	// bytes received by on_readable that don't form a full frame yet
+	std::vector<uint8_t> rx;
+	size_t rx_size = 0;
+
+	// encoded frames the socket didn't take yet
+	std::vector<uint8_t> tx;
+	size_t tx_sent = 0;
+	// errno of the write that failed, see write_tx
+	int write_error = 0;
+
+	// optional bound on frames waiting for the socket, see set_backpressure
+	std::unique_ptr<frame_queue> outbound;
+	// frames past a blocking bound on an event loop, see set_backpressure
+	std::deque<frame_queue::frame> parked;
+	std::function<void(bool)> on_congestion;
+	// see pause_reading
+	bool paused = false;
+
+	// optional filter of repeated state frames, see set_dedup
+	std::unique_ptr<dedup_filter> dedup;
+
+	// entity updates held while far from the player, see set_interest
+	std::unique_ptr<interest_filter> interest;
+
+	// state frames held until the next tick, see set_coalesce
+	std::unique_ptr<coalescer> coalesced;
+	event_loop::clock::duration tick {};
+	std::optional<event_loop::timer> tick_timer;
+
+	// see set_flush_mode
+	flush_mode mode = flush_mode::latency;
+	event_loop::clock::duration flush_interval {};
+	std::optional<event_loop::timer> flush_timer;
+	// see flush_mode::latency
+	std::optional<event_loop::deferral> flush_deferred;
+	size_t writes = 0;
+
+	// see set_stream
+	packet_stream* stream = nullptr;
+	uint32_t stream_source = 0;
+	bitset<256> stream_ids {};
+
+	// see set_idle_timeout
+	event_loop::clock::duration idle_timeout {};
+	event_loop::clock::time_point last_rx;
+	std::optional<event_loop::timer> idle_timer;
+	std::function<void()> on_idle;
+
+	// coroutine suspended in expect() or send(), see net/task.hpp
+	struct waiter {
+		enum { waiting, received, expired, closed } state = waiting;
+		uint8_t id = 0;
+		std::coroutine_handle<> handle;
+		std::span<uint8_t> payload;
+	};
+	waiter* reader = nullptr;
+	waiter* writer = nullptr;
+	event_loop* loop = nullptr;
 
 private:
 	packet::packet_header read_header()
@@ -35,14 +128,270 @@ private:
 		return { id, packet_size - 3 };
 	}
 
+	bool dispatch_frames()
+	{
+		size_t offset = 0;
+		while (rx_size - offset >= 3) {
+			uint16_t frame_size;
+			std::memcpy(&frame_size, rx.data() + offset, sizeof(frame_size));
+			frame_size = to_little(frame_size);
+
+			if (frame_size < 3) {
+				return false;
+			}
+			if (rx_size - offset < frame_size) {
+				break;
+			}
+
+			dispatch(rx[offset + 2], std::span(rx).subspan(offset + 3, frame_size - 3));
+			offset += frame_size;
+		}
+
+		std::memmove(rx.data(), rx.data() + offset, rx_size - offset);
+		rx_size -= offset;
+		return true;
+	}
+
+	static void wake(waiter*& w, decltype(waiter::state) state)
+	{
+		auto p = std::exchange(w, nullptr);
+		p->state = state;
+		p->handle.resume();
+	}
+
+	void fail_waiters()
+	{
+		if (reader != nullptr)
+			wake(reader, waiter::closed);
+		if (writer != nullptr)
+			wake(writer, waiter::closed);
+	}
+
+	static void write_frame(std::vector<uint8_t>& out, uint8_t id, std::span<const uint8_t> payload)
+	{
+		auto buffer = io::serialized_io(io::buffered_io(out));
+		buffer.write(int16_t(payload.size() + 3));
+		buffer.write(id);
+		if (payload.size() > 0) {
+			buffer.write(payload);
+		}
+	}
+
+	// Returns true once everything queued hit the socket. Never throws, it
+	// runs from timers too: a failed write shuts the socket down instead,
+	// so the event loop reports it gone and its owner closes it as usual.
+	bool write_tx()
+	{
+		if (write_error != 0) {
+			return false;
+		}
+		for (;;) {
+			while (tx_sent < tx.size()) {
+				auto bytes = rw.device().write_some(reinterpret_cast<const char*>(tx.data() + tx_sent), tx.size() - tx_sent);
+				writes++;
+				if (bytes < 0) {
+					if (errno == EINTR)
+						continue;
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						return false;
+					write_error = errno;
+					shutdown(native_handle(), SHUT_RDWR);
+					return false;
+				}
+				tx_sent += bytes;
+			}
+
+			tx.clear();
+			tx_sent = 0;
+			if (!outbound) {
+				return true;
+			}
+
+			// refill from the queue, a batch of frames per write
+			while (tx.size() < write_size) {
+				auto f = outbound->pop();
+				if (!f) {
+					break;
+				}
+				if (tx.empty()) {
+					tx = std::move(f->data);
+				} else {
+					tx.insert(tx.end(), f->data.begin(), f->data.end());
+				}
+			}
+			if (!parked.empty()) {
+				while (!parked.empty() && outbound->try_push(parked.front())) {
+					parked.pop_front();
+				}
+				if (parked.empty() && on_congestion) {
+					on_congestion(false);
+				}
+			}
+			if (tx.empty()) {
+				return true;
+			}
+		}
+	}
+
+	bool deliver(uint8_t id, std::span<const uint8_t> payload)
+	{
+		if (dedup && dedup->suppress(id, payload)) {
+			return true;
+		}
+
+		if (!outbound) {
+			write_frame(tx, id, payload);
+		} else if (loop != nullptr && outbound->blocks()) {
+			// the loop can't wait for the socket, frames past the bound are
+			// parked while whoever feeds this conn holds off
+			frame_queue::frame f { id, {} };
+			write_frame(f.data, id, payload);
+			if (outbound->is_lagging()) {
+				return false;
+			}
+			if (!parked.empty() || !outbound->try_push(f)) {
+				parked.push_back(std::move(f));
+				if (parked.size() == 1 && on_congestion) {
+					on_congestion(true);
+				}
+			}
+		} else {
+			frame_queue::frame f { id, {} };
+			write_frame(f.data, id, payload);
+			auto evicted = [this](frame_queue::frame& old) {
+				if (dedup) {
+					dedup->forget(old.id, std::span(old.data).subspan(3));
+				}
+			};
+			if (!outbound->push(f, [this] { return wait_writable(); }, evicted)) {
+				return false;
+			}
+		}
+
+		auto batch_full = tx.size() >= write_size || (outbound && outbound->size() >= outbound->capacity() / 2);
+		if (loop == nullptr || batch_full) {
+			write_tx();
+		} else if (mode == flush_mode::latency) {
+			// everything a dispatch forwards goes out in one write
+			if (!flush_deferred) {
+				flush_deferred = loop->defer([this] {
+					flush_deferred.reset();
+					if (write_tx() && writer != nullptr) {
+						wake(writer, waiter::received);
+					}
+				});
+			}
+		} else if (!flush_timer) {
+			flush_timer = loop->add_timer(flush_interval, [this] {
+				flush_timer.reset();
+				if (write_tx() && writer != nullptr) {
+					wake(writer, waiter::received);
+				}
+			});
+		}
+		return true;
+	}
+
+	void drain_coalesced()
+	{
+		if (coalesced) {
+			coalesced->drain([this](uint8_t id, std::span<const uint8_t> payload) { deliver(id, payload); });
+		}
+	}
+
+	// Checks the last receive time only when the timer fires, so traffic
+	// never touches the wheel.
+	void arm_idle(event_loop::clock::duration delay)
+	{
+		idle_timer = loop->add_timer(delay, [this] {
+			idle_timer.reset();
+			auto idle = loop->now() - last_rx;
+			if (idle < idle_timeout) {
+				arm_idle(idle_timeout - idle);
+			} else {
+				on_idle();
+			}
+		});
+	}
+
+	bool read_exact(std::span<uint8_t> buf)
+	{
+		size_t done = 0;
+		while (done < buf.size()) {
+			auto bytes = rw.device().read_some(reinterpret_cast<char*>(buf.data() + done), buf.size() - done);
+			if (bytes < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytes <= 0) {
+				return false;
+			}
+			done += bytes;
+		}
+		return true;
+	}
+
+	// Only for conns without a loop; gives up on a peer that takes no
+	// bytes for default_timeout.
+	bool wait_writable()
+	{
+		if (write_tx()) {
+			return true;
+		}
+		pollfd p { native_handle(), POLLOUT, 0 };
+		int ready;
+		do {
+			ready = poll(&p, 1, std::chrono::milliseconds(default_timeout).count());
+		} while (ready < 0 && errno == EINTR);
+		if (ready <= 0 && write_error == 0) {
+			write_error = ready == 0 ? ETIMEDOUT : errno;
+			shutdown(native_handle(), SHUT_RDWR);
+		}
+		write_tx();
+		return write_error == 0;
+	}
+
 public:
-	conn(int sock_fd, sockaddr_in conn_addr, socklen_t conn_addr_size)
-	    : rw(io::file_io(sock_fd))
+	basic_conn(I io, sockaddr_in conn_addr, socklen_t conn_addr_size)
+	    : rw(io)
 	    , conn_addr(conn_addr)
 	    , conn_addr_size(conn_addr_size)
 	{
 	}
 
+	int native_handle() const { return rw.device().native_handle(); }
+
+	// The io backend underneath, e.g. to hook up io::uring_io::on_ready().
+	I& device() { return rw.device(); }
+
+	const sockaddr_in& address() const { return conn_addr; }
+
+	// Suspended coroutines get io::file_io::eof thrown at them.
+	void close()
+	{
+		if (tick_timer) {
+			loop->cancel_timer(*tick_timer);
+			tick_timer.reset();
+		}
+		if (idle_timer) {
+			loop->cancel_timer(*idle_timer);
+			idle_timer.reset();
+		}
+		if (flush_timer) {
+			loop->cancel_timer(*flush_timer);
+			flush_timer.reset();
+		}
+		if (flush_deferred) {
+			// e.g. a disconnect forwarded just before the socket goes
+			loop->cancel_deferred(*flush_deferred);
+			flush_deferred.reset();
+			write_tx();
+		}
+		fail_waiters();
+		rw.device().close();
+	}
+
+	void set_nonblocking() { rw.device().set_nonblocking(); }
+
 	template <packet::packet T>
 	void expect_packet(T& t)
 	{
@@ -56,6 +405,89 @@ public:
 		}
 	}
 
+	// Timers of expect() run on this loop, without one expect() never times out.
+	void attach(event_loop& l) { loop = &l; }
+
+	static constexpr auto default_timeout = std::chrono::seconds(30);
+
+	// co_await conn.expect<T>() resumes with the next T received. Other packets
+	// keep going to their handlers meanwhile. Throws timed_out or
+	// io::file_io::eof into the coroutine.
+	template <packet::packet T>
+	auto expect(event_loop::clock::duration timeout = default_timeout)
+	{
+		struct awaiter {
+			basic_conn& c;
+			event_loop::clock::duration timeout;
+			waiter w {};
+			event_loop::timer t {};
+
+			bool await_ready() { return false; }
+
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				assert(c.reader == nullptr);
+				w.id = T::packet_id;
+				w.handle = h;
+				c.reader = &w;
+				if (c.loop) {
+					t = c.loop->add_timer(timeout, [this] {
+						if (c.reader == &w)
+							wake(c.reader, waiter::expired);
+					});
+				}
+			}
+
+			T await_resume()
+			{
+				if (w.state == waiter::expired) {
+					throw timed_out {};
+				}
+				if (c.loop) {
+					c.loop->cancel_timer(t);
+				}
+				if (w.state == waiter::closed) {
+					throw io::file_io::eof {};
+				}
+
+				T value;
+				if (w.payload.size() > 0) {
+					packet::decode_packet(w.payload, value);
+				}
+				return value;
+			}
+		};
+		return awaiter { *this, timeout };
+	}
+
+	// co_await conn.send(p) resumes once the socket took the whole packet.
+	template <packet::packet T>
+	auto send(T p)
+	{
+		struct awaiter {
+			basic_conn& c;
+			bool sent;
+			waiter w {};
+
+			bool await_ready() { return !sent || !c.pending(); }
+
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				assert(c.writer == nullptr);
+				w.handle = h;
+				c.writer = &w;
+			}
+
+			void await_resume()
+			{
+				if (!sent || w.state == waiter::closed) {
+					throw io::file_io::eof {};
+				}
+			}
+		};
+		return awaiter { *this, send_packet(p) };
+	}
+
 	template <class H>
 	void reg_handler(int id, H h)
 	{
@@ -67,95 +499,414 @@ public:
 	{
 		handlers[P::packet_id].push_back([this, h](std::span<uint8_t> payload) {
 			P t;
-			if (payload.size() > 0) {
-				packet::decode_packet(payload, t);
+			if (!packet::try_decode_packet(payload, t)) {
+				// malformed, leave it to the raw handlers
+				return false;
 			}
 			return h(t);
 		});
 	}
 
+	// Rewrites one fixed-offset field in the receive buffer, so the handlers
+	// registered after it (forwarding included) see the new value.
+	// `h` maps the current value to the new one.
+	template <auto M, typename H>
+	void reg_patch(H h)
+	{
+		using F = packet::field<M>;
+		handlers[F::packet_type::packet_id].push_back([h](std::span<uint8_t> payload) {
+			if (payload.size() >= F::offset + F::size) {
+				F::set(payload, h(F::get(payload)));
+			}
+			return false;
+		});
+	}
+
 	template <packet::netmodule P, typename H>
 	void reg_handler(H h)
 	{
+		static_assert(P::module_id < packet::max_netmodules);
 		netmodule_handlers[P::module_id].push_back([this, h](std::span<uint8_t> payload) {
 			P t;
-			if (payload.size() > 0) {
-				packet::decode_packet(payload, t);
+			if (!packet::try_decode_packet(payload, t)) {
+				// malformed, leave it to the raw handlers
+				return false;
 			}
 			return h(t);
 		});
 	}
 
-	void send_packet(uint8_t id, std::span<uint8_t> payload)
+	// Bounds the frames waiting for this socket. With backpressure::block the
+	// sender drains the queue itself, so it has to run on this conn's thread.
+	// On an attached loop nothing waits: frames past the bound are kept and
+	// `on_full(true)` is called, to stop reading whatever feeds this conn
+	// (see pause_reading), then `on_full(false)` once the socket took them.
+	void set_backpressure(size_t capacity, backpressure policy, bitset<256> droppable = {}, std::function<void(bool)> on_full = {})
 	{
-		std::vector<uint8_t> packet_data;
-		auto buffer = io::serialized_io(io::buffered_io(packet_data));
+		outbound = std::make_unique<frame_queue>(capacity, policy, droppable);
+		on_congestion = std::move(on_full);
+	}
 
-		buffer.write(int16_t(payload.size() + 3));
-		buffer.write(id);
-		if (payload.size() > 0) {
-			buffer.write(payload);
+	bool congested() const { return !parked.empty(); }
+
+	// While paused on_readable() leaves the socket alone; the owner drops
+	// EPOLLIN too and re-arms it to resume.
+	void pause_reading(bool p) { paused = p; }
+
+	// Stops sending frames of `ids` that repeat the last one for the same
+	// player within `window`.
+	void set_dedup(bitset<256> ids, dedup_filter::clock::duration window)
+	{
+		dedup = std::make_unique<dedup_filter>(ids, window);
+	}
+
+	size_t suppressed_frames() const { return dedup ? dedup->suppressed_frames() : 0; }
+
+	// Holds frames of `ids` for up to `interval`, sending only the newest one
+	// per player, see packet::coalesced_ids(). Ticks run on the attached
+	// loop; without one, held frames go out on flush().
+	void set_coalesce(bitset<256> ids, event_loop::clock::duration interval)
+	{
+		coalesced = std::make_unique<coalescer>(ids);
+		tick = interval;
+	}
+
+	size_t coalesced_frames() const { return coalesced ? coalesced->replaced_frames() : 0; }
+
+	// Holds back updates about entities further than `radius` pixels from
+	// the player, as the player's own player_controls received here tell.
+	// Calling it again drops the updates held so far, e.g. on a world change.
+	void set_interest(float radius, interest_filter::clock::duration refresh)
+	{
+		if (!interest) {
+			reg_handler<packet::player_controls>([this](packet::player_controls& p) {
+				interest->move(p.position.x, p.position.y, interest_filter::clock::now(), [this](uint8_t id, std::span<const uint8_t> payload) {
+					deliver(id, payload);
+				});
+				return false;
+			});
+		}
+		interest = std::make_unique<interest_filter>(radius, refresh);
+	}
+
+	size_t deferred_frames() const { return interest ? interest->deferred_frames() : 0; }
+
+	// flush_mode::throughput holds frames for up to `interval`, it needs an
+	// attached loop. Pair with socket_options::latency() or throughput().
+	void set_flush_mode(flush_mode m, event_loop::clock::duration interval = std::chrono::milliseconds(5))
+	{
+		mode = m;
+		flush_interval = interval;
+	}
+
+	// Publishes the received frames of `ids` into `s` before handlers see
+	// them, tagged with `source`. `s` has to outlive the conn.
+	void set_stream(packet_stream& s, uint32_t source, bitset<256> ids)
+	{
+		stream = &s;
+		stream_source = source;
+		stream_ids = ids;
+	}
+
+	void set_stream(packet_stream& s, uint32_t source)
+	{
+		bitset<256> all;
+		all.fill(0xff);
+		set_stream(s, source, all);
+	}
+
+	// write syscalls made so far, to see what batching buys
+	size_t write_calls() const { return writes; }
+
+	// Calls `cb` on the attached loop once nothing was received for `timeout`.
+	template <class F>
+	void set_idle_timeout(event_loop::clock::duration timeout, F cb)
+	{
+		assert(loop != nullptr);
+		if (idle_timer) {
+			loop->cancel_timer(*idle_timer);
 		}
+		idle_timeout = timeout;
+		on_idle = cb;
+		last_rx = loop->now();
+		arm_idle(timeout);
+	}
 
-		rw.write(packet_data);
+	// True once the backpressure policy gave up on the peer.
+	bool lagging() const { return outbound && outbound->is_lagging(); }
+
+	// True once a write to the socket failed.
+	bool failed() const { return write_error != 0; }
+
+	// Returns false if the frame was refused because the peer is lagging.
+	bool send_packet(uint8_t id, std::span<const uint8_t> payload)
+	{
+		if (interest && !interest->admit(id, payload, interest_filter::clock::now(), [this](uint8_t id, std::span<const uint8_t> payload) { deliver(id, payload); })) {
+			return true;
+		}
+		if (coalesced && coalesced->hold(id, payload)) {
+			if (loop == nullptr) {
+				return true;
+			}
+			if (!tick_timer) {
+				tick_timer = loop->add_timer(tick, [this] {
+					tick_timer.reset();
+					drain_coalesced();
+				});
+			}
+			return true;
+		}
+		return deliver(id, payload);
+	}
+
+	// Writes queued frames until the socket stops taking them, returns false
+	// while some are still pending. Backends that queue writes
+	// (io::uring_io) only hit the socket here.
+	bool flush()
+	{
+		if (loop == nullptr) {
+			drain_coalesced();
+		}
+
+		auto done = write_tx();
+		if constexpr (requires { rw.device().flush(); }) {
+			rw.device().flush();
+		}
+		return done;
+	}
+
+	bool pending() const
+	{
+		return tx_sent < tx.size() || (outbound && outbound->size() > 0) || !parked.empty() || (coalesced && !coalesced->empty());
+	}
+
+	// Bytes of the socket that live in this conn: received short of a whole
+	// frame, and encoded frames it didn't take yet.
+	struct in_flight {
+		std::vector<uint8_t> rx;
+		std::vector<uint8_t> tx;
+	};
+
+	// Takes what's in flight, frames held for the next tick included, so
+	// another conn (in another process, say) can carry on with the socket.
+	// Frames the dedup and interest filters hold back are dropped.
+	in_flight take_in_flight()
+	{
+		drain_coalesced();
+
+		in_flight f;
+		f.rx.assign(rx.begin(), rx.begin() + rx_size);
+		// read ahead by the backend, see io::uring_io::settle()
+		if constexpr (requires { rw.device().settle(); }) {
+			auto ahead = rw.device().settle();
+			f.rx.insert(f.rx.end(), ahead.begin(), ahead.end());
+		}
+		f.tx.assign(tx.begin() + tx_sent, tx.end());
+		while (outbound) {
+			auto frame = outbound->pop();
+			if (!frame) {
+				break;
+			}
+			f.tx.insert(f.tx.end(), frame->data.begin(), frame->data.end());
+		}
+		for (auto& frame : parked) {
+			f.tx.insert(f.tx.end(), frame.data.begin(), frame.data.end());
+		}
+		parked.clear();
+
+		rx_size = 0;
+		tx.clear();
+		tx_sent = 0;
+		return f;
+	}
+
+	// Picks up where take_in_flight() left off on the same socket. The
+	// bytes to send go out once it's writable, the frames received go to
+	// the handlers on dispatch_restored().
+	void restore(in_flight f)
+	{
+		rx = std::move(f.rx);
+		rx_size = rx.size();
+		tx = std::move(f.tx);
+		tx_sent = 0;
+	}
+
+	// Dispatches the whole frames restore() brought along, once the
+	// handlers are registered: the socket may never report them. False if
+	// they don't parse.
+	bool dispatch_restored()
+	{
+		return rx_size == 0 || dispatch_frames();
 	}
 
 	template <packet::packet T>
-	void send_packet(T p)
+	bool send_packet(T p)
 	{
 		auto payload = encode_packet(p);
-		send_packet(T::packet_id, payload);
+		return send_packet(T::packet_id, payload);
+	}
+
+	template <packet::netmodule T>
+	bool send_packet(T p)
+	{
+		auto payload = encode_netmodule(p);
+		return send_packet(packet::netmodule_packet_id, payload);
+	}
+
+	// Runs `list` until a handler consumes the payload.
+	static bool run_handlers(handler_list& list, std::span<uint8_t> payload)
+	{
+		for (auto& h : list) {
+			if (h(payload) == true) {
+				return true;
+			}
+		}
+		return false;
 	}
 
+	// "handlers.<id>", what profile::scope names the handlers of a packet
+	static const char* handlers_scope(uint8_t id)
+	{
+		static const auto names = [] {
+			std::array<std::string, 256> names;
+			for (size_t i = 0; i < names.size(); i++) {
+				names[i] = "handlers." + std::to_string(i);
+			}
+			return names;
+		}();
+		return names[id].c_str();
+	}
+
+	// Returns true if a netmodule handler consumed the payload.
 	bool handle_netmodule(std::span<uint8_t> payload)
 	{
+		if (payload.size() < sizeof(uint16_t)) {
+			return false;
+		}
+
 		uint16_t id;
 		std::memcpy(&id, payload.data(), sizeof(id));
 		id = to_little(id);
 
-		if (netmodule_handlers[id].size() <= 0) {
-			// currently i won't bother implementing netmodules
-			// FIXME: return false
+		if (id >= netmodule_handlers.size()) {
+			return false;
+		}
+		return run_handlers(netmodule_handlers[id], payload.subspan(2));
+	}
+
+	bool dispatch(uint8_t id, std::span<uint8_t> payload)
+	{
+		if (id == 0) {
+			return false;
+		}
+
+		if (stream && stream_ids[id]) {
+			stream->publish(stream_source, id, payload);
+		}
+
+		if (reader != nullptr && reader->id == id) {
+			reader->payload = payload;
+			wake(reader, waiter::received);
 			return true;
 		}
 
-		for (auto& h : handlers[id]) {
-			if (h(payload.subspan(2)) == true) {
-				return false;
-			}
+		profile::scope p(handlers_scope(id));
+		// netmodules nobody consumed still reach the raw packet 82 handlers
+		if (packet::info(id).netmodules && handle_netmodule(payload)) {
+			return true;
+		}
+
+		if (handlers[id].size() <= 0) {
+			return false;
 		}
+
+		run_handlers(handlers[id], payload);
 		return true;
 	}
 
+	// Reads and dispatches one frame from a blocking socket. Returns false
+	// once the peer is gone or sent a bad header, without throwing.
 	bool handle()
 	{
-		try {
-			auto [id, len] = read_header();
-			if (id == 0) {
-				return false;
-			}
+		if (rx.size() < 3) {
+			rx.resize(read_size);
+		}
+		if (!read_exact(std::span(rx).first(3))) {
+			return false;
+		}
 
-			std::vector<uint8_t> payload(len);
-			rw.read(payload);
+		uint16_t frame_size;
+		std::memcpy(&frame_size, rx.data(), sizeof(frame_size));
+		frame_size = to_little(frame_size);
+		if (frame_size < 3) {
+			return false;
+		}
+
+		auto id = rx[2];
+		if (rx.size() < frame_size) {
+			rx.resize(frame_size);
+		}
+
+		auto payload = std::span(rx).subspan(3, frame_size - 3);
+		if (!read_exact(payload)) {
+			return false;
+		}
+		return dispatch(id, payload);
+	}
 
-			// got netmodule
-			if (id == 82) {
-				return handle_netmodule(payload);
+	// Event loop counterpart of handle(): drains a non-blocking socket and
+	// dispatches every complete frame. Returns false once the peer is gone.
+	bool on_readable()
+	{
+		for (;;) {
+			if (paused) {
+				return true;
+			}
+			if (rx.size() - rx_size < read_size) {
+				rx.resize(rx_size + read_size);
 			}
 
-			if (handlers[id].size() <= 0) {
+			auto bytes = rw.device().read_some(reinterpret_cast<char*>(rx.data() + rx_size), rx.size() - rx_size);
+			if (bytes < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return true;
+			}
+			if (bytes <= 0) {
+				fail_waiters();
 				return false;
 			}
 
-			for (auto& h : handlers[id]) {
-				if (h(payload) == true) {
-					break;
-				}
+			rx_size += bytes;
+			if (loop) {
+				last_rx = loop->now();
+			}
+			if (!dispatch_frames()) {
+				fail_waiters();
+				return false;
+			}
+		}
+	}
+
+	// Event loop counterpart of flush().
+	bool on_writable()
+	{
+		try {
+			if (flush() && writer != nullptr) {
+				wake(writer, waiter::received);
+			}
+			if (failed()) {
+				fail_waiters();
+				return false;
 			}
 			return true;
 		} catch (io::file_io::eof e) {
+			fail_waiters();
 			return false;
 		}
 	}
 };
+
+using conn = basic_conn<io::file_io>;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "util/bitset.hpp"
+
+namespace net {
+
+// Drops frames that repeat, byte for byte, the last one sent for the same
+// (packet id, client id). The client id is the first payload byte, so only
+// ids of packets that start with one belong in `ids`, see
+// packet::player_ids(). Everything else always passes.
+//
+// An identical frame still goes out once `window` passed since the last one,
+// which also bounds how stale a peer gets if a sent frame was later evicted.
+class dedup_filter {
+public:
+	using clock = std::chrono::steady_clock;
+
+private:
+	struct last_sent {
+		std::vector<uint8_t> payload;
+		clock::time_point at;
+	};
+
+	bitset<256> ids;
+	clock::duration window;
+	std::unordered_map<uint16_t, last_sent> sent;
+	size_t suppressed = 0;
+
+public:
+	dedup_filter(bitset<256> ids, clock::duration window)
+	    : ids(ids)
+	    , window(window)
+	{
+	}
+
+	// True if the frame is a repeat and shouldn't be sent.
+	bool suppress(uint8_t id, std::span<const uint8_t> payload)
+	{
+		if (!ids[id] || payload.empty()) {
+			return false;
+		}
+
+		auto now = clock::now();
+		auto& last = sent[uint16_t(id) << 8 | payload[0]];
+		if (now - last.at < window && std::ranges::equal(last.payload, payload)) {
+			suppressed++;
+			return true;
+		}
+
+		last.payload.assign(payload.begin(), payload.end());
+		last.at = now;
+		return false;
+	}
+
+	// The frame suppress() let through never made it out after all, so
+	// the next one like it mustn't be suppressed.
+	void forget(uint8_t id, std::span<const uint8_t> payload)
+	{
+		if (!ids[id] || payload.empty()) {
+			return;
+		}
+		auto it = sent.find(uint16_t(id) << 8 | payload[0]);
+		if (it != sent.end() && std::ranges::equal(it->second.payload, payload)) {
+			sent.erase(it);
+		}
+	}
+
+	size_t suppressed_frames() const { return suppressed; }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "net/timer_wheel.hpp"
+
+namespace net {
+
+// epoll based readiness loop. Callbacks are stored in a table indexed by fd,
+// everything except wake() must be called from the thread running the loop.
+class event_loop {
+public:
+	using callback = std::function<void(uint32_t events)>;
+
+	using clock = timer_wheel::clock;
+	using timer = timer_wheel::timer;
+
+	// Handle of a defer()red callback, stays safe to cancel after it ran.
+	struct deferral {
+		uint64_t batch;
+		size_t index;
+	};
+
+private:
+	struct entry {
+		callback cb;
+		uint32_t generation;
+	};
+
+	static constexpr int max_events = 256;
+
+	int epoll_fd;
+	int wake_fd;
+	std::atomic<bool> running = true;
+
+	std::vector<std::unique_ptr<entry>> entries;
+	// entries removed while dispatching, freed once the batch is done
+	std::vector<std::unique_ptr<entry>> retired;
+	uint32_t generation = 0;
+
+	std::function<void()> wake_cb;
+
+	timer_wheel timers;
+	// see defer()
+	std::vector<std::function<void()>> deferred;
+	uint64_t batch = 0;
+	// taken once per batch, see now()
+	clock::time_point batch_time = clock::now();
+
+	static uint64_t pack(int fd, uint32_t generation)
+	{
+		return uint64_t(generation) << 32 | uint32_t(fd);
+	}
+
+	void run_deferred()
+	{
+		// callbacks may defer more, they run in this pass too
+		for (size_t i = 0; i < deferred.size(); i++) {
+			if (auto cb = std::move(deferred[i])) {
+				cb();
+			}
+		}
+		deferred.clear();
+		batch++;
+	}
+
+public:
+	event_loop()
+	{
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (wake_fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		add(wake_fd, EPOLLIN, [this](uint32_t) {
+			uint64_t count;
+			while (::read(wake_fd, &count, sizeof(count)) > 0) {
+			}
+			if (wake_cb)
+				wake_cb();
+		});
+	}
+
+	event_loop(const event_loop&) = delete;
+	event_loop& operator=(const event_loop&) = delete;
+
+	~event_loop()
+	{
+		close(wake_fd);
+		close(epoll_fd);
+	}
+
+	void add(int fd, uint32_t events, callback cb)
+	{
+		if (size_t(fd) >= entries.size()) {
+			entries.resize(fd + 1);
+		}
+		entries[fd] = std::make_unique<entry>(entry { std::move(cb), ++generation });
+
+		epoll_event ev {};
+		ev.events = events;
+		ev.data.u64 = pack(fd, entries[fd]->generation);
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+			throw std::runtime_error(strerror(errno));
+	}
+
+	void modify(int fd, uint32_t events)
+	{
+		epoll_event ev {};
+		ev.events = events;
+		ev.data.u64 = pack(fd, entries.at(fd)->generation);
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+			throw std::runtime_error(strerror(errno));
+	}
+
+	void remove(int fd)
+	{
+		if (size_t(fd) >= entries.size() || !entries[fd]) {
+			return;
+		}
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+		retired.push_back(std::move(entries[fd]));
+	}
+
+	// Called on the loop thread after any wake().
+	void on_wake(std::function<void()> cb)
+	{
+		wake_cb = std::move(cb);
+	}
+
+	// Safe to call from any thread.
+	void wake()
+	{
+		uint64_t one = 1;
+		[[maybe_unused]] auto _ = ::write(wake_fd, &one, sizeof(one));
+	}
+
+	// When the current batch of events started. Cheaper than clock::now()
+	// for callbacks that only need to know roughly when they ran.
+	clock::time_point now() const { return batch_time; }
+
+	// `cb` runs on the loop thread once `delay` has passed, unless cancelled
+	// first. Millisecond resolution, O(1) to arm and cancel.
+	timer add_timer(clock::duration delay, std::function<void()> cb)
+	{
+		return timers.add(clock::now() + delay, std::move(cb));
+	}
+
+	// Safe with timers that already fired.
+	void cancel_timer(timer t)
+	{
+		timers.cancel(t);
+	}
+
+	// `cb` runs on the loop thread once every callback of the current
+	// batch of events (or timers) did, e.g. to write what they queued at once.
+	deferral defer(std::function<void()> cb)
+	{
+		deferred.push_back(std::move(cb));
+		return { batch, deferred.size() - 1 };
+	}
+
+	// Safe with callbacks that already ran.
+	void cancel_deferred(deferral d)
+	{
+		if (d.batch == batch && d.index < deferred.size()) {
+			deferred[d.index] = nullptr;
+		}
+	}
+
+	void run_once(int timeout_ms = -1)
+	{
+		if (auto next = timers.next_expiry(clock::now())) {
+			auto ms = std::chrono::ceil<std::chrono::milliseconds>(*next).count();
+			if (timeout_ms < 0 || ms < timeout_ms) {
+				timeout_ms = int(ms);
+			}
+		}
+
+		epoll_event events[max_events];
+		int n = epoll_wait(epoll_fd, events, max_events, timeout_ms);
+		if (n < 0) {
+			if (errno == EINTR)
+				return;
+			throw std::runtime_error(strerror(errno));
+		}
+
+		batch_time = clock::now();
+		for (int i = 0; i < n; i++) {
+			int fd = int(events[i].data.u64 & 0xFFFFFFFF);
+			uint32_t gen = events[i].data.u64 >> 32;
+
+			// skip fds removed (and maybe reused) earlier in this batch
+			auto e = entries[fd].get();
+			if (e == nullptr || e->generation != gen) {
+				continue;
+			}
+			e->cb(events[i].events);
+		}
+		run_deferred();
+		retired.clear();
+
+		batch_time = clock::now();
+		timers.advance(batch_time);
+		run_deferred();
+	}
+
+	void run()
+	{
+		while (running) {
+			run_once();
+		}
+	}
+
+	// Safe to call from any thread.
+	void stop()
+	{
+		running = false;
+		wake();
+	}
+};
+
+}
\ No newline at end of file
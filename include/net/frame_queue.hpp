@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "util/bitset.hpp"
+#include "util/spsc_queue.hpp"
+
+namespace net {
+
+// What the producer does when the consumer can't keep up.
+enum class backpressure {
+	// wait for the consumer to make room
+	block,
+	// evict the oldest frame; evicting a frame that isn't droppable marks the consumer as lagging
+	drop_oldest,
+	// mark the consumer as lagging straight away
+	disconnect,
+};
+
+// Bounded queue of encoded frames for one direction of a connection.
+class frame_queue {
+public:
+	struct frame {
+		uint8_t id;
+		std::vector<uint8_t> data;
+	};
+
+private:
+	spsc_queue<frame> frames;
+	backpressure policy;
+	bitset<256> droppable;
+
+	std::atomic<bool> lagging = false;
+	std::atomic<size_t> dropped = 0;
+
+public:
+	frame_queue(size_t capacity, backpressure policy, bitset<256> droppable = {})
+	    : frames(capacity)
+	    , policy(policy)
+	    , droppable(droppable)
+	{
+	}
+
+	// Producer side, `wait` is called while a blocking queue is full and
+	// returns false to give up on the consumer, `evicted(frame&)` gets the
+	// frames drop_oldest throws away. Returns false once the consumer is
+	// lagging and should be dropped.
+	template <class W, class E>
+	bool push(frame& f, W wait, E evicted)
+	{
+		if (lagging) {
+			return false;
+		}
+		if (frames.try_push(f)) {
+			return true;
+		}
+
+		switch (policy) {
+		case backpressure::block:
+			do {
+				if (!wait()) {
+					lagging = true;
+					return false;
+				}
+			} while (!frames.try_push(f));
+			return true;
+
+		case backpressure::drop_oldest:
+			do {
+				if (auto old = frames.try_pop()) {
+					if (!droppable[old->id]) {
+						lagging = true;
+						return false;
+					}
+					evicted(*old);
+					dropped++;
+				}
+			} while (!frames.try_push(f));
+			return true;
+
+		case backpressure::disconnect:
+			lagging = true;
+			return false;
+		}
+		return false;
+	}
+
+	template <class W>
+	bool push(frame& f, W wait)
+	{
+		return push(f, wait, [](frame&) {});
+	}
+
+	// Producer side, never waits: false if the queue is full or the
+	// consumer is lagging.
+	bool try_push(frame& f)
+	{
+		return !lagging && frames.try_push(f);
+	}
+
+	// Consumer side.
+	std::optional<frame> pop()
+	{
+		return frames.try_pop();
+	}
+
+	bool is_lagging() const { return lagging; }
+
+	bool blocks() const { return policy == backpressure::block; }
+
+	size_t dropped_frames() const { return dropped; }
+
+	size_t size() const { return frames.size(); }
+
+	size_t capacity() const { return frames.capacity(); }
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace net {
+
+namespace detail {
+
+inline sockaddr_un unix_address(const std::string& path)
+{
+	sockaddr_un addr {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error(path + ": path too long for a unix socket");
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	return addr;
+}
+
+}
+
+// One end of a Unix socket passing records of bytes and file descriptors
+// (SCM_RIGHTS) between processes, e.g. the sockets of a proxy being
+// replaced to its successor. The receiver gets its own descriptors of the
+// same sockets, the sender may close its copies once send() returned.
+class handoff {
+	int fd = -1;
+
+	// A record is a message with its size and fds, then its bytes in
+	// messages of up to chunk_size, which any socket buffer takes.
+	static constexpr size_t chunk_size = 32 * 1024;
+	static constexpr size_t max_fds = 64;
+
+	void send_message(const msghdr& msg)
+	{
+		while (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+			if (errno != EINTR)
+				throw std::runtime_error(strerror(errno));
+		}
+	}
+
+	size_t receive_message(msghdr& msg)
+	{
+		for (;;) {
+			auto bytes = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+			if (bytes >= 0)
+				return bytes;
+			if (errno != EINTR)
+				throw std::runtime_error(strerror(errno));
+		}
+	}
+
+	static void close_all(std::span<const int> fds)
+	{
+		for (auto f : fds) {
+			::close(f);
+		}
+	}
+
+public:
+	struct record {
+		std::vector<uint8_t> data;
+		// owned by the receiver
+		std::vector<int> fds;
+	};
+
+	explicit handoff(int fd)
+	    : fd(fd)
+	{
+	}
+
+	handoff(handoff&& other)
+	    : fd(std::exchange(other.fd, -1))
+	{
+	}
+
+	handoff(const handoff&) = delete;
+
+	~handoff()
+	{
+		if (fd >= 0)
+			::close(fd);
+	}
+
+	// Throws if nobody listens at `path`.
+	static handoff connect(const std::string& path)
+	{
+		int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		auto addr = detail::unix_address(path);
+		if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+			auto error = errno;
+			::close(fd);
+			throw std::runtime_error(strerror(error));
+		}
+		return handoff(fd);
+	}
+
+	void send(std::span<const uint8_t> data, std::span<const int> fds = {})
+	{
+		assert(fds.size() <= max_fds);
+
+		uint32_t size = data.size();
+		iovec header { &size, sizeof(size) };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)] {};
+
+		msghdr msg {};
+		msg.msg_iov = &header;
+		msg.msg_iovlen = 1;
+		if (!fds.empty()) {
+			msg.msg_control = control;
+			msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+			auto c = CMSG_FIRSTHDR(&msg);
+			c->cmsg_level = SOL_SOCKET;
+			c->cmsg_type = SCM_RIGHTS;
+			c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+			std::memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+		}
+		send_message(msg);
+
+		for (size_t sent = 0; sent < data.size(); sent += chunk_size) {
+			iovec chunk { const_cast<uint8_t*>(data.data() + sent), std::min(chunk_size, data.size() - sent) };
+			msghdr m {};
+			m.msg_iov = &chunk;
+			m.msg_iovlen = 1;
+			send_message(m);
+		}
+	}
+
+	// The next record, or nullopt once the other end finish()ed or exited.
+	std::optional<record> receive()
+	{
+		uint32_t size = 0;
+		iovec header { &size, sizeof(size) };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)];
+
+		msghdr msg {};
+		msg.msg_iov = &header;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		auto bytes = receive_message(msg);
+		if (bytes == 0) {
+			return std::nullopt;
+		}
+
+		record r;
+		for (auto c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+				auto n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				auto at = r.fds.size();
+				r.fds.resize(at + n);
+				std::memcpy(r.fds.data() + at, CMSG_DATA(c), n * sizeof(int));
+			}
+		}
+		if (bytes != sizeof(size) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+			close_all(r.fds);
+			throw std::runtime_error("malformed handoff record");
+		}
+
+		r.data.resize(size);
+		for (size_t received = 0; received < size;) {
+			iovec chunk { r.data.data() + received, size - received };
+			msghdr m {};
+			m.msg_iov = &chunk;
+			m.msg_iovlen = 1;
+			auto n = receive_message(m);
+			if (n == 0) {
+				close_all(r.fds);
+				throw std::runtime_error("handoff record cut short");
+			}
+			received += n;
+		}
+		return r;
+	}
+
+	// Tells the other end no more records follow.
+	void finish() { shutdown(fd, SHUT_WR); }
+};
+
+// Where a successor connects to take over, see handoff. Replaces the
+// socket file a previous process left at `path`.
+class handoff_listener {
+	int fd = -1;
+
+public:
+	explicit handoff_listener(const std::string& path)
+	{
+		auto addr = detail::unix_address(path);
+		fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		unlink(path.c_str());
+		if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+			auto error = errno;
+			::close(fd);
+			throw std::runtime_error(strerror(error));
+		}
+	}
+
+	handoff_listener(const handoff_listener&) = delete;
+
+	~handoff_listener() { ::close(fd); }
+
+	// Blocks until a successor connects.
+	handoff accept()
+	{
+		for (;;) {
+			int c = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (c >= 0)
+				return handoff(c);
+			if (errno != EINTR)
+				throw std::runtime_error(strerror(errno));
+		}
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "net/conn.hpp"
+#include "net/packet.hpp"
+#include "net/registry.hpp"
+#include "net/types.hpp"
+
+namespace net {
+
+// What a client sent to join a server, kept up to date afterwards (newest
+// player_info, inventory slots, health...), so the join can be replayed to
+// another server when the player moves there, up to spawning in its world.
+class handshake {
+	struct frame {
+		uint8_t id;
+		std::vector<uint8_t> payload;
+	};
+
+	std::optional<frame> request;
+	std::vector<frame> frames;
+	std::unordered_map<uint32_t, size_t> index;
+
+	static uint32_t key(uint8_t id, std::span<const uint8_t> payload)
+	{
+		// inventory slots are kept one per slot, anything else one per id
+		if (id == packet::player_inventory_slot::packet_id && payload.size() >= packet::field<&packet::player_inventory_slot::slot_id>::offset + 2) {
+			return uint32_t(id) << 16 | uint16_t(packet::field<&packet::player_inventory_slot::slot_id>::get(payload));
+		}
+		return uint32_t(id) << 16;
+	}
+
+public:
+	// packets replayed, all but conn_request, request_world_data, request_tiles_at and player_uuid lead with the client id
+	static bitset<256> recorded_ids()
+	{
+		using namespace packet;
+		auto ids = player_ids<player_info, player_inventory_slot, player_health, player_mana, update_player_buffs, player_zones, player_loadout, spawn_player>();
+		ids[conn_request::packet_id] = true;
+		ids[request_world_data::packet_id] = true;
+		ids[request_tiles_at::packet_id] = true;
+		ids[player_uuid::packet_id] = true;
+		return ids;
+	}
+
+	// every packet that leads with a client id, the ones to remap between slots
+	static bitset<256> slot_ids()
+	{
+		return packet::ids_where([](const packet::traits& t) { return t.player; });
+	}
+
+	void record(uint8_t id, std::span<const uint8_t> payload)
+	{
+		if (id == packet::conn_request::packet_id) {
+			request = frame { id, { payload.begin(), payload.end() } };
+			return;
+		}
+
+		auto [it, inserted] = index.try_emplace(key(id, payload), frames.size());
+		if (inserted) {
+			frames.push_back({ id, { payload.begin(), payload.end() } });
+		} else {
+			frames[it->second].payload.assign(payload.begin(), payload.end());
+		}
+	}
+
+	// Records what `c` receives from the client, consuming nothing.
+	template <class I>
+	void observe(basic_conn<I>& c)
+	{
+		auto ids = recorded_ids();
+		for (int id = 1; id < 256; id++) {
+			if (ids[id]) {
+				c.reg_handler(id, [this, id](std::span<uint8_t> payload) {
+					record(id, payload);
+					return false;
+				});
+			}
+		}
+	}
+
+	// True once the client went all the way into its world, so there's a
+	// whole join to replay.
+	bool joined() const { return request && index.contains(key(packet::spawn_player::packet_id, {})); }
+
+	// Calls `f(id, payload)` for everything recorded, conn_request first;
+	// record()ing them elsewhere makes a copy.
+	template <class F>
+	void for_each(F f) const
+	{
+		if (request) {
+			f(request->id, std::span<const uint8_t>(request->payload));
+		}
+		for (auto& r : frames) {
+			f(r.id, std::span<const uint8_t>(r.payload));
+		}
+	}
+
+	// conn_request, to be answered by packet::accept before replay()
+	std::span<const uint8_t> connect_request() const { return request->payload; }
+
+	// Calls `send(id, payload)` for every recorded frame, as the player in `slot`.
+	template <class F>
+	void replay(uint8_t slot, F send) const
+	{
+		auto ids = slot_ids();
+		for (auto& f : frames) {
+			auto payload = f.payload;
+			if (ids[f.id] && !payload.empty()) {
+				payload[0] = slot;
+			}
+			send(f.id, std::span(payload));
+		}
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "net/packet.hpp"
+#include "net/spatial_grid.hpp"
+#include "net/types.hpp"
+
+namespace net {
+
+// Holds back updates about NPCs, projectiles and items further than
+// `radius` pixels from the player, keeping only the latest one per entity.
+// A held update goes out once the player comes near, or after `refresh`
+// so far away entities don't freeze altogether. Updates that take an
+// entity out of the world, and everything else, always pass.
+class interest_filter {
+public:
+	using clock = std::chrono::steady_clock;
+
+private:
+	struct held {
+		uint8_t id;
+		std::vector<uint8_t> payload;
+		clock::time_point since;
+	};
+
+	float radius;
+	clock::duration refresh;
+
+	// the player, unknown until it first reported where it is
+	std::optional<std::pair<float, float>> center;
+
+	std::unordered_map<uint64_t, held> frames;
+	// where the entities with a held update are
+	spatial_grid positions;
+	clock::time_point last_sweep;
+	size_t deferred = 0;
+
+	static uint64_t key(entity_kind kind, uint32_t id) { return uint64_t(kind) << 32 | id; }
+
+	bool near(float x, float y) const
+	{
+		auto dx = x - center->first, dy = y - center->second;
+		return dx * dx + dy * dy <= radius * radius;
+	}
+
+	// The fixed size fields `T` starts with, std::nullopt if `payload` is shorter.
+	template <class T>
+	static std::optional<T> decode(std::span<const uint8_t> payload)
+	{
+		if (payload.size() < packet::wire_size<T>()) {
+			return std::nullopt;
+		}
+		T t;
+		io::serialized_io(io::unchecked_io { payload.data() }).read(t);
+		return t;
+	}
+
+	void forget(entity_kind kind, uint32_t id)
+	{
+		if (frames.erase(key(kind, id))) {
+			positions.remove(kind, id);
+		}
+	}
+
+	bool admit(entity_kind kind, uint32_t id, float x, float y, uint8_t packet_id, std::span<const uint8_t> payload, clock::time_point now)
+	{
+		if (near(x, y)) {
+			forget(kind, id);
+			return true;
+		}
+
+		auto [it, inserted] = frames.try_emplace(key(kind, id));
+		if (inserted) {
+			it->second.since = now;
+		}
+		it->second.id = packet_id;
+		it->second.payload.assign(payload.begin(), payload.end());
+		positions.update(kind, id, x, y);
+		deferred++;
+		return false;
+	}
+
+	// Sends the held updates older than `refresh`.
+	template <class F>
+	void sweep(clock::time_point now, F& send)
+	{
+		if (now - last_sweep < refresh) {
+			return;
+		}
+		last_sweep = now;
+
+		for (auto it = frames.begin(); it != frames.end();) {
+			if (now - it->second.since < refresh) {
+				++it;
+				continue;
+			}
+			send(it->second.id, std::span<const uint8_t>(it->second.payload));
+			positions.remove(entity_kind(it->first >> 32), uint32_t(it->first));
+			it = frames.erase(it);
+		}
+	}
+
+public:
+	interest_filter(float radius, clock::duration refresh)
+	    : radius(radius)
+	    , refresh(refresh)
+	{
+	}
+
+	// updates held back so far, replaced ones included
+	size_t deferred_frames() const { return deferred; }
+
+	size_t held_frames() const { return frames.size(); }
+
+	// The player moved; sends `send(id, payload)` the updates about entities
+	// that are near now.
+	template <class F>
+	void move(float x, float y, clock::time_point now, F send)
+	{
+		center = { x, y };
+
+		std::vector<spatial_grid::entity> close;
+		positions.query_radius(x, y, radius, [&](const spatial_grid::entity& e) { close.push_back(e); });
+		for (auto& e : close) {
+			auto it = frames.find(key(e.kind, e.id));
+			send(it->second.id, std::span<const uint8_t>(it->second.payload));
+			frames.erase(it);
+			positions.remove(e.kind, e.id);
+		}
+		sweep(now, send);
+	}
+
+	// False if the frame is held back. `send` gets the held updates that
+	// are due meanwhile.
+	template <class F>
+	bool admit(uint8_t id, std::span<const uint8_t> payload, clock::time_point now, F send)
+	{
+		if (!center) {
+			return true;
+		}
+		sweep(now, send);
+
+		using namespace packet;
+		switch (id) {
+		case npc_update::packet_id:
+			if (auto n = decode<npc_update>(payload)) {
+				if (!npc_update_alive(payload).value_or(true)) {
+					forget(entity_kind::npc, uint16_t(n->npc_id));
+					return true;
+				}
+				return admit(entity_kind::npc, uint16_t(n->npc_id), n->position.x, n->position.y, id, payload, now);
+			}
+			return true;
+		case projectile_update::packet_id:
+			if (auto p = decode<projectile_update>(payload)) {
+				auto projectile = spatial_grid::projectile_key(p->owner, p->projectile_id);
+				return admit(entity_kind::projectile, projectile, p->position.x, p->position.y, id, payload, now);
+			}
+			return true;
+		case kill_projectile::packet_id:
+			if (auto p = decode<kill_projectile>(payload)) {
+				forget(entity_kind::projectile, spatial_grid::projectile_key(p->owner, p->projectile_id));
+			}
+			return true;
+		case drop_item::packet_id:
+			if (auto d = decode<drop_item>(payload)) {
+				if (d->new_id == 0 || d->stack == 0) {
+					forget(entity_kind::item, uint16_t(d->old_id));
+					return true;
+				}
+				return admit(entity_kind::item, uint16_t(d->old_id), d->position.x, d->position.y, id, payload, now);
+			}
+			return true;
+		default:
+			return true;
+		}
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "net/conn.hpp"
+#include "net/layout.hpp"
+#include "net/packet.hpp"
+#include "net/types.hpp"
+
+namespace net {
+
+// The latest world_info of a server and the spawn sections it sends joining
+// players, so the proxy can answer a joining client right away instead of
+// waiting on the server. The server still gets the client's requests, it
+// has to for the join to go through; of what it sends back, sections equal
+// to the ones served from the cache are dropped, the rest is forwarded and
+// corrects whatever was stale. Any thread may use it.
+class join_cache {
+public:
+	struct snapshot {
+		std::vector<uint8_t> world_info;
+		// the request_tiles_at the sections answered, they're around that spot
+		std::vector<uint8_t> request;
+		// send_tile_data payloads, as compressed as the server sent them
+		std::vector<std::vector<uint8_t>> sections;
+	};
+
+private:
+	mutable std::mutex lock;
+	std::shared_ptr<const snapshot> current = std::make_shared<snapshot>();
+
+	std::atomic<uint64_t> hits = 0;
+	std::atomic<uint64_t> dropped = 0;
+
+	static size_t hash(std::span<const uint8_t> payload)
+	{
+		return std::hash<std::string_view> {}(std::string_view(reinterpret_cast<const char*>(payload.data()), payload.size()));
+	}
+
+	static bool equal(std::span<const uint8_t> a, std::span<const uint8_t> b)
+	{
+		return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+	}
+
+	static std::optional<int32_t> world_id(std::span<const uint8_t> world_info)
+	{
+		return packet::peek<&packet::world_info::world_id>(world_info);
+	}
+
+	// One joining player.
+	struct join {
+		std::shared_ptr<const snapshot> from;
+		std::vector<uint8_t> request;
+		// sections served from `from`, by hash, to recognize the server's copies
+		std::unordered_multimap<size_t, size_t> served;
+		// what the server sent, for the next joins
+		std::vector<std::vector<uint8_t>> sections;
+		bool spawned = false;
+	};
+
+public:
+	std::shared_ptr<const snapshot> get() const
+	{
+		std::lock_guard l(lock);
+		return current;
+	}
+
+	void store_world_info(std::span<const uint8_t> payload)
+	{
+		auto next = std::make_shared<snapshot>();
+		next->world_info.assign(payload.begin(), payload.end());
+
+		std::lock_guard l(lock);
+		// the sections of another world are no use
+		if (world_id(current->world_info) == world_id(payload)) {
+			next->request = current->request;
+			next->sections = current->sections;
+		}
+		current = std::move(next);
+	}
+
+	void store_sections(std::span<const uint8_t> request, std::vector<std::vector<uint8_t>> sections)
+	{
+		std::lock_guard l(lock);
+		if (current->world_info.empty()) {
+			return;
+		}
+		auto next = std::make_shared<snapshot>(*current);
+		next->request.assign(request.begin(), request.end());
+		next->sections = std::move(sections);
+		current = std::move(next);
+	}
+
+	// joins answered from the cache
+	uint64_t served_joins() const { return hits.load(std::memory_order_relaxed); }
+
+	// sections of the server left out because the client had them already
+	uint64_t dropped_sections() const { return dropped.load(std::memory_order_relaxed); }
+
+	// Keeps the world_info up to date from what a backend connection
+	// receives. Register it before handlers that consume packets.
+	template <class I>
+	void observe(basic_conn<I>& upstream)
+	{
+		upstream.reg_handler(packet::world_info::packet_id, [this](std::span<uint8_t> payload) {
+			store_world_info(payload);
+			return false;
+		});
+	}
+
+	// Answers `client`'s request_world_data and request_tiles_at from the
+	// cache when it has something, and drops the sections `upstream` sends
+	// that it already got. The requests still go on to the server, and
+	// the sections it sends before spawning the player refresh the cache.
+	// Register it before the forwarding handlers.
+	template <class I>
+	void serve(basic_conn<I>& client, basic_conn<I>& upstream)
+	{
+		using namespace packet;
+
+		auto state = std::make_shared<join>();
+		client.reg_handler(request_world_data::packet_id, [this, state, &client](std::span<uint8_t>) {
+			state->from = get();
+			if (!state->from->world_info.empty()) {
+				client.send_packet(world_info::packet_id, state->from->world_info);
+			}
+			return false;
+		});
+		client.reg_handler(request_tiles_at::packet_id, [this, state, &client](std::span<uint8_t> payload) {
+			if (state->spawned || !state->request.empty()) {
+				return false;
+			}
+			state->request.assign(payload.begin(), payload.end());
+			// a player spawning at its bed needs other sections
+			if (!state->from || state->from->world_info.empty() || !equal(state->from->request, payload)) {
+				return false;
+			}
+			auto& sections = state->from->sections;
+			for (size_t i = 0; i < sections.size(); i++) {
+				client.send_packet(send_tile_data::packet_id, sections[i]);
+				state->served.emplace(hash(sections[i]), i);
+			}
+			hits.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		});
+		upstream.reg_handler(send_tile_data::packet_id, [this, state](std::span<uint8_t> payload) {
+			if (state->spawned) {
+				return false;
+			}
+			state->sections.emplace_back(payload.begin(), payload.end());
+
+			auto [begin, end] = state->served.equal_range(hash(payload));
+			for (auto it = begin; it != end; ++it) {
+				if (equal(state->from->sections[it->second], payload)) {
+					state->served.erase(it);
+					dropped.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+			return false;
+		});
+		upstream.reg_handler(initial_spawn_player::packet_id, [this, state](std::span<uint8_t>) {
+			if (!state->spawned && !state->request.empty() && !state->sections.empty()) {
+				store_sections(state->request, std::move(state->sections));
+			}
+			// whatever comes later is news to the client
+			state->spawned = true;
+			state->served.clear();
+			state->sections = {};
+			return false;
+		});
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include <boost/pfr/core.hpp>
+#include <boost/pfr/tuple_size.hpp>
+
+#include "net/types.hpp"
+#include "util/endian.hpp"
+#include "util/io.hpp"
+
+namespace net {
+namespace packet {
+
+// Compile time wire layout of packet structs, as serialized_io reads them.
+
+constexpr size_t dynamic_size = std::numeric_limits<size_t>::max();
+
+template <class T>
+constexpr size_t wire_size();
+
+namespace detail {
+
+template <class T>
+concept custom_io = requires(T& t, io::serialized_io<io::buffered_io<std::vector<uint8_t>>>& s) { t.read(s); };
+
+template <class T>
+struct is_array : std::false_type { };
+
+template <class T, size_t N>
+struct is_array<std::array<T, N>> : std::true_type { };
+
+template <class T, size_t... I>
+constexpr size_t fields_size(std::index_sequence<I...>)
+{
+	size_t size = 0;
+	bool fixed = true;
+	[[maybe_unused]] auto add = [&](size_t s) {
+		if (s == dynamic_size)
+			fixed = false;
+		else
+			size += s;
+	};
+	(add(wire_size<boost::pfr::tuple_element_t<I, T>>()), ...);
+	return fixed ? size : dynamic_size;
+}
+
+template <class T, class F, size_t I>
+constexpr bool is_field(T& t, F T::*m)
+{
+	if constexpr (std::is_same_v<boost::pfr::tuple_element_t<I, T>, F>) {
+		return &boost::pfr::get<I>(t) == &(t.*m);
+	} else {
+		return false;
+	}
+}
+
+template <class T, class F, size_t... I>
+consteval size_t field_index(F T::*m, std::index_sequence<I...>)
+{
+	T t {};
+	size_t index = dynamic_size;
+	((is_field<T, F, I>(t, m) ? index = I : 0), ...);
+	return index;
+}
+
+template <class T>
+T from_wire(T v)
+{
+	if constexpr (std::floating_point<T>) {
+		using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+		return std::bit_cast<T>(to_little(std::bit_cast<U>(v)));
+	} else if constexpr (std::same_as<T, bool>) {
+		return v;
+	} else {
+		return to_little(v);
+	}
+}
+
+}
+
+// Bytes `T` takes on the wire, or dynamic_size if that depends on its contents.
+template <class T>
+constexpr size_t wire_size()
+{
+	if constexpr (std::is_arithmetic_v<T>) {
+		return sizeof(T);
+	} else if constexpr (detail::is_array<T>::value) {
+		constexpr auto element = wire_size<typename T::value_type>();
+		return element == dynamic_size ? dynamic_size : element * std::tuple_size_v<T>;
+	} else if constexpr (requires { typename T::array_type; }) {
+		// fixed bitset
+		return wire_size<typename T::array_type>();
+	} else if constexpr (io::container<T> || detail::custom_io<T>) {
+		return dynamic_size;
+	} else {
+		return detail::fields_size<T>(std::make_index_sequence<boost::pfr::tuple_size_v<T>> {});
+	}
+}
+
+// Offset of field `I` of `T` in its payload, dynamic_size if a variable sized field comes first.
+template <class T, size_t I>
+constexpr size_t field_offset()
+{
+	return detail::fields_size<T>(std::make_index_sequence<I> {});
+}
+
+// Typed view of one fixed-offset scalar field, e.g. field<&player_health::current>.
+// Reads and rewrites the bytes in place, without decoding the rest of the packet.
+template <auto M>
+struct field;
+
+template <class T, class F, F T::*M>
+struct field<M> {
+	using packet_type = T;
+	using value_type = F;
+
+	static constexpr size_t index = detail::field_index<T, F>(M, std::make_index_sequence<boost::pfr::tuple_size_v<T>> {});
+	static constexpr size_t offset = field_offset<T, index>();
+	static constexpr size_t size = wire_size<F>();
+
+	static_assert(std::is_arithmetic_v<F>, "only scalar fields can be patched");
+	static_assert(offset != dynamic_size, "field comes after a variable sized one");
+
+	// `payload` has to be at least offset + size bytes
+	static F get(std::span<const uint8_t> payload)
+	{
+		F v;
+		std::memcpy(&v, payload.data() + offset, size);
+		return detail::from_wire(v);
+	}
+
+	static void set(std::span<uint8_t> payload, F v)
+	{
+		v = detail::from_wire(v);
+		std::memcpy(payload.data() + offset, &v, size);
+	}
+};
+
+template <auto M>
+std::optional<typename field<M>::value_type> peek(std::span<const uint8_t> payload)
+{
+	if (payload.size() < field<M>::offset + field<M>::size) {
+		return std::nullopt;
+	}
+	return field<M>::get(payload);
+}
+
+template <auto M>
+bool patch(std::span<uint8_t> payload, typename field<M>::value_type v)
+{
+	if (payload.size() < field<M>::offset + field<M>::size) {
+		return false;
+	}
+	field<M>::set(payload, v);
+	return true;
+}
+
+}
+}
\ No newline at end of file
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <expected>
 #include <format>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <vector>
 
@@ -16,8 +20,10 @@
 #include <boost/pfr/core.hpp>
 #include <zlib.h>
 
+#include "layout.hpp"
 #include "types.hpp"
 #include "util/io.hpp"
+#include "util/profile.hpp"
 
 namespace net {
 
@@ -25,20 +31,136 @@ namespace packet {
 
 using packet_header = std::tuple<uint8_t, uint16_t>;
 
-template <packet T>
-void decode_packet(std::span<uint8_t> payload, T& t)
+// Ids of the droppable packets among `Ts`.
+template <packet... Ts>
+bitset<256> droppable_ids()
+{
+	bitset<256> ids {};
+	((ids[Ts::packet_id] = droppable_packet<Ts>), ...);
+	return ids;
+}
+
+template <class T>
+constexpr bool leads_with_client_id()
+{
+	if constexpr (player_packet<T>) {
+		return field<&T::client_id>::offset == 0;
+	} else {
+		return false;
+	}
+}
+
+// Ids of `Ts`, packets about one player that lead with its client id.
+template <player_packet... Ts>
+bitset<256> player_ids()
 {
-	std::size_t len = 0;
+	static_assert((leads_with_client_id<Ts>() && ...), "client_id has to come first");
+	bitset<256> ids {};
+	((ids[Ts::packet_id] = true), ...);
+	return ids;
+}
 
-	auto rd = io::serialized_io(io::buffered_io { payload });
-	len = rd.read(t);
+// Ids of the coalesced packets among `Ts`.
+template <packet... Ts>
+bitset<256> coalesced_ids()
+{
+	static_assert(((!coalesced_packet<Ts> || leads_with_client_id<Ts>()) && ...), "client_id has to come first");
+	bitset<256> ids {};
+	((ids[Ts::packet_id] = coalesced_packet<Ts>), ...);
+	return ids;
+}
+
+enum class decode_error {
+	// the payload ends before the packet does
+	truncated,
+	// bytes left over after the packet
+	trailing,
+};
 
-	if (len != payload.size()) {
-		throw std::runtime_error(std::format("{}: {}", len, payload.size()));
+// Decodes `payload` into `t` without throwing.
+template <class T>
+	requires packet<T> || netmodule<T>
+std::expected<void, decode_error> try_decode_packet(std::span<uint8_t> payload, T& t)
+{
+	constexpr auto size = wire_size<T>();
+
+	if constexpr (size != dynamic_size) {
+		if (payload.size() < size) {
+			return std::unexpected(decode_error::truncated);
+		}
+		if (payload.size() > size && !partial_packet<T>) {
+			return std::unexpected(decode_error::trailing);
+		}
+
+		auto rd = io::serialized_io(io::unchecked_io { payload.data() });
+		rd.read(t);
+		return {};
+	} else {
+		static_assert(!partial_packet<T>, "a partial packet needs a fixed size");
+
+		auto rd = io::serialized_io(io::buffered_io { payload });
+		std::size_t len = rd.read(t);
+
+		if (rd.device().truncated()) {
+			return std::unexpected(decode_error::truncated);
+		}
+		if (len != payload.size()) {
+			return std::unexpected(decode_error::trailing);
+		}
+		return {};
 	}
 }
 
-template <packet T>
+// Whether an npc_update payload leaves the NPC alive, std::nullopt if it's
+// too short to tell. Its life comes after a run of flag dependent fields.
+inline std::optional<bool> npc_update_alive(std::span<const uint8_t> payload)
+{
+	size_t offset = wire_size<npc_update>();
+	if (payload.size() < offset + 2) {
+		return std::nullopt;
+	}
+	auto flags = payload[offset];
+	auto flags2 = payload[offset + 1];
+	if (flags & 128) {
+		// at full life
+		return true;
+	}
+
+	offset += 2 + std::popcount(uint8_t(flags & 0b111100)) * sizeof(float) + sizeof(int16_t);
+	offset += (flags2 & 1 ? 1 : 0) + (flags2 & 4 ? sizeof(float) : 0);
+	if (payload.size() < offset + 1) {
+		return std::nullopt;
+	}
+
+	auto size = payload[offset++];
+	if ((size != 1 && size != 2 && size != 4) || payload.size() < offset + size) {
+		return std::nullopt;
+	}
+	int32_t life = 0;
+	if (size == 1) {
+		life = int8_t(payload[offset]);
+	} else if (size == 2) {
+		int16_t v;
+		std::memcpy(&v, payload.data() + offset, sizeof(v));
+		life = to_little(v);
+	} else {
+		std::memcpy(&life, payload.data() + offset, sizeof(life));
+		life = to_little(life);
+	}
+	return life > 0;
+}
+
+template <class T>
+	requires packet<T> || netmodule<T>
+void decode_packet(std::span<uint8_t> payload, T& t)
+{
+	if (auto r = try_decode_packet(payload, t); !r) {
+		throw std::runtime_error(std::format("{} payload of {} bytes", r.error() == decode_error::truncated ? "truncated" : "oversized", payload.size()));
+	}
+}
+
+template <class T>
+	requires packet<T> || netmodule<T>
 std::vector<uint8_t> encode_packet_impl(T& t)
 {
 	std::vector<uint8_t> payload;
@@ -54,6 +176,18 @@ std::vector<uint8_t> encode_packet(T& t)
 	return encode_packet_impl(t);
 }
 
+// Payload of packet 82 carrying `t`.
+template <netmodule T>
+std::vector<uint8_t> encode_netmodule(T& t)
+{
+	std::vector<uint8_t> payload;
+	auto wt = io::serialized_io(io::buffered_io { payload });
+	wt.write(uint16_t(T::module_id));
+	wt.write(t);
+
+	return payload;
+}
+
 template <compressed_packet T>
 std::vector<uint8_t> encode_packet(T& t)
 {
@@ -61,15 +195,17 @@ std::vector<uint8_t> encode_packet(T& t)
 	std::array<uint8_t, chunk_size> buffer;
 	std::vector<uint8_t> payload;
 
-	int ret, flush;
+	int ret;
 	z_stream strm;
 
 	auto raw_payload = encode_packet_impl(t);
 
+	profile::scope p("zlib.deflate");
 	strm.zalloc = Z_NULL;
 	strm.zfree = Z_NULL;
 	strm.opaque = Z_NULL;
-	ret = deflateInit(&strm, 15);
+	// raw deflate, no zlib header, like .NET's DeflateStream
+	ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
 	if (ret != Z_OK)
 		throw std::runtime_error("deflate init error");
 
@@ -78,7 +214,7 @@ std::vector<uint8_t> encode_packet(T& t)
 	do {
 		strm.avail_out = chunk_size;
 		strm.next_out = reinterpret_cast<Bytef*>(buffer.data());
-		ret = deflate(&strm, flush);
+		ret = deflate(&strm, Z_FINISH);
 		assert(ret != Z_STREAM_ERROR);
 		payload.insert(payload.end(), buffer.begin(), buffer.end() - strm.avail_out);
 	} while (strm.avail_out == 0);
@@ -88,6 +224,47 @@ std::vector<uint8_t> encode_packet(T& t)
 	deflateEnd(&strm);
 	return payload;
 }
+
+// Largest inflated payload taken: a 200x150 tile section at up to 16 bytes
+// a tile, with room to spare for its chests, signs and tile entities.
+inline constexpr size_t max_inflated_size = 640 * 1024;
+
+// Inflates the payload of a compressed packet, std::nullopt if it's corrupt
+// or inflates past `limit`.
+inline std::optional<std::vector<uint8_t>> decompress_payload(std::span<const uint8_t> payload, size_t limit = max_inflated_size)
+{
+	static constexpr auto chunk_size = 16 * 1024;
+	std::vector<uint8_t> raw;
+
+	profile::scope p("zlib.inflate");
+	z_stream strm {};
+	if (inflateInit2(&strm, -15) != Z_OK)
+		throw std::runtime_error("inflate init error");
+
+	strm.avail_in = payload.size();
+	strm.next_in = const_cast<Bytef*>(payload.data());
+	int ret;
+	do {
+		if (raw.size() >= limit) {
+			inflateEnd(&strm);
+			return std::nullopt;
+		}
+		raw.resize(raw.size() + chunk_size);
+		strm.avail_out = chunk_size;
+		strm.next_out = raw.data() + raw.size() - chunk_size;
+		ret = inflate(&strm, Z_NO_FLUSH);
+	} while (ret == Z_OK && strm.avail_out == 0);
+
+	inflateEnd(&strm);
+	if (ret != Z_STREAM_END) {
+		return std::nullopt;
+	}
+	raw.resize(raw.size() - strm.avail_out);
+	if (raw.size() > limit) {
+		return std::nullopt;
+	}
+	return raw;
+}
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace net {
+
+namespace detail {
+
+struct stream_header {
+	static constexpr uint64_t magic_value = 0x6d61657274736b70; // "pkstream"
+
+	uint64_t magic;
+	uint32_t record_count;
+	uint32_t record_size;
+
+	// sequence number the next publish() takes
+	alignas(64) std::atomic<uint64_t> head;
+};
+
+struct stream_record {
+	// 2n+1 while record n is written, 2n+2 once it's complete
+	std::atomic<uint64_t> seq;
+	uint32_t source;
+	// of the whole payload, the record may hold only its start
+	uint16_t size;
+	uint8_t id;
+	uint8_t pad;
+
+	// the payload follows the record
+	uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+	const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory needs address free atomics");
+
+inline size_t stream_bytes(uint32_t count, uint32_t size)
+{
+	return sizeof(stream_header) + size_t(count) * size;
+}
+
+}
+
+// Frames published into shared memory (a memfd) for other processes to
+// read, e.g. anti-cheat or analytics tools that must not slow the proxy.
+//
+// The memory is a ring of fixed size records, every one guarded by a
+// sequence number like player_table's slots: publishing never waits on
+// readers, it just overwrites the oldest record. Readers keep their own
+// position and notice from the sequence numbers when they fell behind,
+// see stream_reader.
+class packet_stream {
+	int fd = -1;
+	void* mem = MAP_FAILED;
+	size_t len = 0;
+
+	detail::stream_header* header;
+	uint64_t mask;
+
+	detail::stream_record& record(uint64_t seq)
+	{
+		auto base = static_cast<uint8_t*>(mem) + sizeof(detail::stream_header);
+		return *reinterpret_cast<detail::stream_record*>(base + (seq & mask) * header->record_size);
+	}
+
+public:
+	// `count` records of `size` bytes each, both powers of two. Payloads
+	// longer than size - sizeof(stream_record) are cut off.
+	packet_stream(uint32_t count = 16 * 1024, uint32_t size = 512)
+	    : len(detail::stream_bytes(count, size))
+	    , mask(count - 1)
+	{
+		assert(count > 0 && (count & mask) == 0);
+		assert(size >= 64 && (size & (size - 1)) == 0);
+
+		fd = memfd_create("ogurec-packets", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		// readers can rely on the size staying put
+		if (ftruncate(fd, len) < 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+			close(fd);
+			throw std::runtime_error(strerror(errno));
+		}
+
+		mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error(strerror(errno));
+		}
+
+		header = new (mem) detail::stream_header { detail::stream_header::magic_value, count, size, 0 };
+	}
+
+	packet_stream(const packet_stream&) = delete;
+
+	~packet_stream()
+	{
+		munmap(mem, len);
+		close(fd);
+	}
+
+	int native_handle() const { return fd; }
+
+	// What another process of the same user opens the stream by.
+	std::string path() const { return "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd); }
+
+	uint64_t published() const { return header->head.load(std::memory_order_relaxed); }
+
+	// Safe from any thread. `source` tells readers where the frame came from.
+	void publish(uint32_t source, uint8_t id, std::span<const uint8_t> payload)
+	{
+		auto seq = header->head.fetch_add(1, std::memory_order_relaxed);
+		auto& r = record(seq);
+
+		auto v = r.seq.load(std::memory_order_relaxed);
+		for (;;) {
+			if (v >= 2 * seq + 1) {
+				// a publisher a whole lap ahead got there first, this one's already lost
+				return;
+			}
+			if ((v & 1) == 0 && r.seq.compare_exchange_weak(v, 2 * seq + 1, std::memory_order_acquire)) {
+				break;
+			}
+			v = r.seq.load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+
+		auto room = header->record_size - sizeof(detail::stream_record);
+		r.source = source;
+		r.size = payload.size();
+		r.id = id;
+		std::memcpy(r.data(), payload.data(), std::min(payload.size(), room));
+
+		r.seq.store(2 * seq + 2, std::memory_order_release);
+	}
+};
+
+// Read side of a packet_stream, usually in another process. Reads happen
+// in place, without copying the frames out of the shared memory.
+class stream_reader {
+public:
+	struct frame {
+		uint64_t seq;
+		uint32_t source;
+		uint8_t id;
+		// the whole payload size, more than `payload` holds if it was cut off
+		uint16_t size;
+		std::span<const uint8_t> payload;
+	};
+
+	enum class status {
+		read,
+		// nothing new yet
+		empty,
+		// the publisher overwrote frames before they were read, see lost()
+		overrun,
+	};
+
+private:
+	int fd = -1;
+	const void* mem = MAP_FAILED;
+	size_t len = 0;
+
+	const detail::stream_header* header;
+	uint64_t mask;
+
+	uint64_t next = 0;
+	uint64_t skipped = 0;
+
+	const detail::stream_record& record(uint64_t seq) const
+	{
+		auto base = static_cast<const uint8_t*>(mem) + sizeof(detail::stream_header);
+		return *reinterpret_cast<const detail::stream_record*>(base + (seq & mask) * header->record_size);
+	}
+
+	// Jumps ahead to where frames are likely to stay put a while.
+	void catch_up()
+	{
+		auto head = header->head.load(std::memory_order_acquire);
+		auto resume = head - std::min<uint64_t>(head, header->record_count / 2);
+		skipped += resume - next;
+		next = resume;
+	}
+
+public:
+	// `path` as given by packet_stream::path(). Starts at the newest frame.
+	explicit stream_reader(const std::string& path)
+	{
+		fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		struct stat st;
+		if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(detail::stream_header)) {
+			close(fd);
+			throw std::runtime_error("not a packet stream");
+		}
+		len = st.st_size;
+
+		mem = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error(strerror(errno));
+		}
+
+		header = static_cast<const detail::stream_header*>(mem);
+		if (header->magic != detail::stream_header::magic_value || len != detail::stream_bytes(header->record_count, header->record_size)) {
+			munmap(const_cast<void*>(mem), len);
+			close(fd);
+			throw std::runtime_error("not a packet stream");
+		}
+		mask = header->record_count - 1;
+		next = header->head.load(std::memory_order_acquire);
+	}
+
+	stream_reader(const stream_reader&) = delete;
+
+	~stream_reader()
+	{
+		munmap(const_cast<void*>(mem), len);
+		close(fd);
+	}
+
+	// frames overwritten before this reader got to them
+	uint64_t lost() const { return skipped; }
+
+	// Calls `f(const frame&)` with the next frame, if there is one. On
+	// status::overrun `f` may have seen a frame that changed under it, so
+	// drop whatever it made of it; the reader already skipped ahead.
+	template <class F>
+	status read(F f)
+	{
+		if (header->head.load(std::memory_order_acquire) - next > header->record_count) {
+			catch_up();
+			return status::overrun;
+		}
+
+		auto& r = record(next);
+		auto before = r.seq.load(std::memory_order_acquire);
+		if (before < 2 * next + 2) {
+			// not published yet, or still being written
+			return status::empty;
+		}
+		if (before > 2 * next + 2) {
+			catch_up();
+			return status::overrun;
+		}
+
+		auto room = header->record_size - sizeof(detail::stream_record);
+		const frame current { next, r.source, r.id, r.size, std::span(r.data(), std::min<size_t>(r.size, room)) };
+		f(current);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (r.seq.load(std::memory_order_relaxed) != before) {
+			catch_up();
+			return status::overrun;
+		}
+		next++;
+		return status::read;
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "net/conn.hpp"
+#include "net/types.hpp"
+#include "version.hpp"
+
+namespace net {
+
+// Latest state of every player slot, as seen in the packets passing through.
+// Stored one array per field, so a query over all players only touches the
+// columns it reads.
+//
+// Every slot has a sequence number (seqlock): writers bump it to odd while
+// they update the slot, readers never block and retry if it moved under them.
+// Any thread may read or write.
+class player_table {
+public:
+	template <class T>
+	using column = std::array<T, max_players>;
+
+	struct columns {
+		column<bool> active;
+		column<std::array<char, max_name_length>> name;
+		column<uint16_t> health;
+		column<uint16_t> health_max;
+		column<uint16_t> mana;
+		column<uint16_t> mana_max;
+		column<std::array<uint16_t, max_buffs>> buffs;
+		column<uint32_t> zones;
+		column<uint8_t> zones2;
+		column<uint8_t> loadout;
+		column<std::array<int16_t, max_inventory_slots>> item_id;
+		column<std::array<int16_t, max_inventory_slots>> item_amount;
+		column<std::array<uint8_t, max_inventory_slots>> item_prefix;
+	};
+
+	// One row, as returned by get().
+	struct player {
+		std::string name;
+		uint16_t health;
+		uint16_t health_max;
+		uint16_t mana;
+		uint16_t mana_max;
+		std::array<uint16_t, max_buffs> buffs;
+		uint32_t zones;
+		uint8_t zones2;
+		uint8_t loadout;
+	};
+
+private:
+	columns cols {};
+	std::array<std::atomic<uint32_t>, max_players> seq {};
+
+	template <class T>
+	static void store(T& dst, const T& src)
+	{
+		if constexpr (requires { src.size(); }) {
+			for (size_t i = 0; i < src.size(); i++) {
+				store(dst[i], src[i]);
+			}
+		} else {
+			std::atomic_ref(dst).store(src, std::memory_order_relaxed);
+		}
+	}
+
+	template <class T>
+	static T load(const T& src)
+	{
+		if constexpr (requires { src.size(); }) {
+			T dst;
+			for (size_t i = 0; i < src.size(); i++) {
+				dst[i] = load(src[i]);
+			}
+			return dst;
+		} else {
+			return std::atomic_ref(const_cast<T&>(src)).load(std::memory_order_relaxed);
+		}
+	}
+
+	// Runs `f(columns&)` with `slot` locked against other writers.
+	template <class F>
+	void write(uint8_t slot, F f)
+	{
+		auto& s = seq[slot];
+		auto v = s.load(std::memory_order_relaxed);
+		for (;;) {
+			if ((v & 1) == 0 && s.compare_exchange_weak(v, v + 1, std::memory_order_acquire)) {
+				break;
+			}
+			v = s.load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+
+		f(cols);
+
+		s.store(v + 2, std::memory_order_release);
+	}
+
+	// Calls `f(const columns&)` until it ran without a writer touching `slot`.
+	template <class F>
+	auto read(uint8_t slot, F f) const
+	{
+		auto& s = seq[slot];
+		for (;;) {
+			auto before = s.load(std::memory_order_acquire);
+			if (before & 1) {
+				continue;
+			}
+			auto value = f(cols);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (s.load(std::memory_order_relaxed) == before) {
+				return value;
+			}
+		}
+	}
+
+public:
+	// Consistent copy of one column, e.g. read(&player_table::columns::health).
+	// Each slot is consistent on its own, not the column as a whole.
+	template <class T>
+	column<T> read(column<T> columns::*c) const
+	{
+		column<T> out;
+		for (size_t i = 0; i < max_players; i++) {
+			out[i] = read(i, [&](const columns& cols) { return load((cols.*c)[i]); });
+		}
+		return out;
+	}
+
+	bool active(uint8_t slot) const
+	{
+		return slot < max_players && read(slot, [&](const columns& cols) { return load(cols.active[slot]); });
+	}
+
+	std::optional<player> get(uint8_t slot) const
+	{
+		if (slot >= max_players) {
+			return std::nullopt;
+		}
+		return read(slot, [&](const columns& cols) -> std::optional<player> {
+			if (!load(cols.active[slot])) {
+				return std::nullopt;
+			}
+			auto name = load(cols.name[slot]);
+			return player {
+				std::string(name.data(), std::find(name.begin(), name.end(), '\0')),
+				load(cols.health[slot]),
+				load(cols.health_max[slot]),
+				load(cols.mana[slot]),
+				load(cols.mana_max[slot]),
+				load(cols.buffs[slot]),
+				load(cols.zones[slot]),
+				load(cols.zones2[slot]),
+				load(cols.loadout[slot]),
+			};
+		});
+	}
+
+	// Forgets whoever was in `slot`.
+	void clear(uint8_t slot)
+	{
+		if (slot >= max_players) {
+			return;
+		}
+		write(slot, [&](columns& cols) {
+			store(cols.active[slot], false);
+		});
+	}
+
+	void apply(const packet::player_info& p)
+	{
+		if (p.client_id >= max_players) {
+			return;
+		}
+		std::array<char, max_name_length> name {};
+		std::copy_n(p.name.begin(), std::min(p.name.size(), name.size()), name.begin());
+
+		write(p.client_id, [&](columns& cols) {
+			store(cols.active[p.client_id], true);
+			store(cols.name[p.client_id], name);
+		});
+	}
+
+	void apply(const packet::player_health& p)
+	{
+		if (p.client_id >= max_players) {
+			return;
+		}
+		write(p.client_id, [&](columns& cols) {
+			store(cols.health[p.client_id], p.current);
+			store(cols.health_max[p.client_id], p.max);
+		});
+	}
+
+	void apply(const packet::player_mana& p)
+	{
+		if (p.client_id >= max_players) {
+			return;
+		}
+		write(p.client_id, [&](columns& cols) {
+			store(cols.mana[p.client_id], p.current);
+			store(cols.mana_max[p.client_id], p.max);
+		});
+	}
+
+	void apply(const packet::update_player_buffs& p)
+	{
+		if (p.client_id >= max_players) {
+			return;
+		}
+		write(p.client_id, [&](columns& cols) {
+			store(cols.buffs[p.client_id], p.buffs);
+		});
+	}
+
+	void apply(const packet::player_zones& p)
+	{
+		if (p.client_id >= max_players) {
+			return;
+		}
+		write(p.client_id, [&](columns& cols) {
+			store(cols.zones[p.client_id], p.zone_flags);
+			store(cols.zones2[p.client_id], p.zone_flags2);
+		});
+	}
+
+	void apply(const packet::player_loadout& p)
+	{
+		if (p.client_id >= max_players) {
+			return;
+		}
+		write(p.client_id, [&](columns& cols) {
+			store(cols.loadout[p.client_id], p.index);
+		});
+	}
+
+	void apply(const packet::player_inventory_slot& p)
+	{
+		if (p.client_id >= max_players || p.slot_id < 0 || p.slot_id >= max_inventory_slots) {
+			return;
+		}
+		write(p.client_id, [&](columns& cols) {
+			store(cols.item_id[p.client_id][p.slot_id], p.item_id);
+			store(cols.item_amount[p.client_id][p.slot_id], p.amount);
+			store(cols.item_prefix[p.client_id][p.slot_id], p.prefix);
+		});
+	}
+
+	// Calls `f.template operator()<P>()` for every packet type P the table
+	// is kept up to date from.
+	template <class F>
+	static void for_each_tracked(F f)
+	{
+		f.template operator()<packet::player_info>();
+		f.template operator()<packet::player_health>();
+		f.template operator()<packet::player_mana>();
+		f.template operator()<packet::update_player_buffs>();
+		f.template operator()<packet::player_zones>();
+		f.template operator()<packet::player_loadout>();
+		f.template operator()<packet::player_inventory_slot>();
+	}
+
+	// Decodes and applies a frame of a tracked packet, e.g. one replayed
+	// to a backend; anything else is ignored.
+	void apply(uint8_t id, std::span<uint8_t> payload)
+	{
+		for_each_tracked([&]<class P>() {
+			P p;
+			if (id == P::packet_id && packet::try_decode_packet(payload, p)) {
+				apply(p);
+			}
+		});
+	}
+
+	// Keeps whichever table `table_of(client_id)` returns, if any, up to date
+	// from what `c` receives; for players that move between tables. Register
+	// it before handlers that consume packets.
+	template <class I, class F>
+	static void observe_into(basic_conn<I>& c, F table_of)
+	{
+		for_each_tracked([&]<class P>() {
+			c.template reg_handler<P>([table_of](P& p) {
+				if (player_table* t = table_of(p.client_id)) {
+					t->apply(p);
+				}
+				return false;
+			});
+		});
+	}
+
+	// Keeps the table up to date from what `c` receives. Register it before
+	// handlers that consume packets. Only slots `accept(client_id)` agrees to
+	// are recorded, e.g. the player's own one on its client connection.
+	template <class I, class F>
+	void observe(basic_conn<I>& c, F accept)
+	{
+		observe_into(c, [this, accept](uint8_t id) { return accept(id) ? this : nullptr; });
+	}
+
+	template <class I>
+	void observe(basic_conn<I>& c)
+	{
+		observe(c, [](uint8_t) { return true; });
+	}
+};
+
+}
\ No newline at end of file
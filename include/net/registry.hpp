@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "net/layout.hpp"
+#include "net/packet.hpp"
+#include "net/types.hpp"
+#include "util/bitset.hpp"
+
+namespace net {
+namespace packet {
+
+// Who sends a packet. Ids the registry doesn't know may go either way.
+enum class direction : uint8_t {
+	to_server = 1,
+	to_client = 2,
+	both = to_server | to_client,
+};
+
+// What's known about a packet (or netmodule) id at compile time, from the
+// struct types.hpp models it with and its flags.
+struct traits {
+	bool known = false;
+	// wire_size() of the struct; a partial packet's only counts the
+	// modelled fields
+	size_t size = dynamic_size;
+	direction dir = direction::both;
+	bool compressed = false;
+	bool droppable = false;
+	// coalesced per player, keyed by the client id it leads with
+	bool coalesced = false;
+	bool partial = false;
+	// leads with the client id of the player it's about
+	bool player = false;
+	// carries netmodules, prefixed by their module id
+	bool netmodules = false;
+
+	constexpr bool fixed_size() const { return size != dynamic_size; }
+	constexpr bool sent_by_client() const { return uint8_t(dir) & uint8_t(direction::to_server); }
+	constexpr bool sent_by_server() const { return uint8_t(dir) & uint8_t(direction::to_client); }
+};
+
+template <class... Ts>
+struct type_list { };
+
+// Every packet types.hpp models, add new ones here too.
+using packets = type_list<conn_request, disconnect, accept, player_info, player_inventory_slot,
+    request_world_data, world_info, request_tiles_at, statusbar_text, send_tile_data, spawn_player,
+    player_controls, player_active, player_health, tile_manipulation, drop_item, npc_update,
+    projectile_update, kill_projectile, player_zones, request_password, send_password, player_mana,
+    initial_spawn_player, update_player_buffs, world_evil, player_uuid, npc_kill_count, tower_powers,
+    damage_player, connection_completed, monster_types, player_loadout>;
+
+using netmodules = type_list<client_text, chat_message>;
+
+namespace detail {
+
+template <class T>
+constexpr direction direction_of()
+{
+	static_assert(!(server_bound_packet<T> && client_bound_packet<T>), "to_server and to_client, leave both out instead");
+	if constexpr (server_bound_packet<T>) {
+		return direction::to_server;
+	} else if constexpr (client_bound_packet<T>) {
+		return direction::to_client;
+	} else {
+		return direction::both;
+	}
+}
+
+template <class T>
+constexpr traits traits_of()
+{
+	traits t;
+	t.known = true;
+	t.size = wire_size<T>();
+	t.dir = direction_of<T>();
+	if constexpr (packet<T>) {
+		t.compressed = compressed_packet<T>;
+		t.droppable = droppable_packet<T>;
+		t.coalesced = coalesced_packet<T>;
+		t.partial = partial_packet<T>;
+		t.player = leads_with_client_id<T>();
+	}
+	return t;
+}
+
+template <class... Ts>
+consteval std::array<traits, 256> packet_table(type_list<Ts...>)
+{
+	std::array<traits, 256> table {};
+	bool unique = true;
+	auto add = [&](uint8_t id, traits t) {
+		unique &= !table[id].known;
+		table[id] = t;
+	};
+	(add(Ts::packet_id, traits_of<Ts>()), ...);
+	table[netmodule_packet_id].netmodules = true;
+
+	if (!unique) {
+		throw "two packets share an id";
+	}
+	return table;
+}
+
+template <class... Ts>
+consteval std::array<traits, max_netmodules> netmodule_table(type_list<Ts...>)
+{
+	std::array<traits, max_netmodules> table {};
+	bool unique = true;
+	// a module may have one type each way, e.g. text: chat from clients
+	// and messages from servers
+	auto add = [&](uint16_t id, traits t) {
+		if (id >= max_netmodules) {
+			unique = false;
+			return;
+		}
+		auto& known = table[id];
+		if (known.known) {
+			unique &= !(uint8_t(known.dir) & uint8_t(t.dir));
+			t.dir = direction(uint8_t(known.dir) | uint8_t(t.dir));
+			if (known.size != t.size) {
+				t.size = dynamic_size;
+			}
+		}
+		known = t;
+	};
+	(add(Ts::module_id, traits_of<Ts>()), ...);
+
+	if (!unique) {
+		throw "two netmodules share an id and a direction, or one's past max_netmodules";
+	}
+	return table;
+}
+
+}
+
+inline constexpr auto packet_table = detail::packet_table(packets {});
+inline constexpr auto netmodule_table = detail::netmodule_table(netmodules {});
+
+constexpr const traits& info(uint8_t id) { return packet_table[id]; }
+
+// Ids whose traits pass `pred(const traits&)`, e.g. every droppable
+// packet for a frame_queue.
+template <class F>
+bitset<256> ids_where(F pred)
+{
+	bitset<256> ids {};
+	for (size_t id = 0; id < packet_table.size(); id++) {
+		ids[id] = pred(packet_table[id]);
+	}
+	return ids;
+}
+
+static_assert(info(send_tile_data::packet_id).compressed);
+static_assert(info(player_health::packet_id).coalesced && info(player_health::packet_id).player);
+static_assert(!info(netmodule_packet_id).known && info(netmodule_packet_id).netmodules);
+static_assert(netmodule_table[chat_message::module_id].dir == direction::both);
+
+}
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "net/client.hpp"
+#include "net/socket_options.hpp"
+
+namespace net {
+
+// One server a proxy can send players to.
+struct backend {
+	std::string name;
+	std::string host;
+	int port;
+
+	// players currently routed here
+	std::atomic<int> players = 0;
+
+	net::client client(socket_options options = {}) const { return net::client(host, port, options); }
+};
+
+// Picks a backend for each incoming player: the first rule that names one
+// wins, otherwise the one with the fewest players. Set it up before the
+// runtime starts, after that it's safe to use from every shard.
+class router {
+public:
+	using rule = std::function<backend*(router&, const sockaddr_in& peer)>;
+
+private:
+	std::vector<std::unique_ptr<backend>> backends;
+	std::vector<rule> rules;
+
+public:
+	backend& add(std::string name, std::string host, int port)
+	{
+		backends.push_back(std::make_unique<backend>(std::move(name), std::move(host), port));
+		return *backends.back();
+	}
+
+	void add_rule(rule r) { rules.push_back(std::move(r)); }
+
+	backend* find(const std::string& name)
+	{
+		auto it = std::ranges::find(backends, name, [](auto& b) { return b->name; });
+		return it == backends.end() ? nullptr : it->get();
+	}
+
+	backend& least_loaded()
+	{
+		return **std::ranges::min_element(backends, {}, [](auto& b) { return b->players.load(); });
+	}
+
+	backend& route(const sockaddr_in& peer)
+	{
+		for (auto& r : rules) {
+			if (auto b = r(*this, peer)) {
+				return *b;
+			}
+		}
+		return least_loaded();
+	}
+
+	backend& at(size_t i) { return *backends.at(i); }
+
+	size_t size() const { return backends.size(); }
+};
+
+}
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <optional>
 #include <stdexcept>
 #include <string>
 
@@ -19,43 +20,83 @@
 #include <unistd.h>
 
 #include "net/conn.hpp"
+#include "net/socket_options.hpp"
+#include "util/uring.hpp"
 
 namespace net {
 
 class server {
 	struct sockaddr_in server_address {};
-	int sock_fd;
+	int sock_fd = -1;
+	socket_options options;
+
+	// Errors accept(2) passes up from the connection being accepted rather
+	// than the listener, the caller should just try again.
+	static bool transient(int error)
+	{
+		switch (error) {
+		case EINTR:
+		case ECONNABORTED:
+		case EPROTO:
+		case ENETDOWN:
+		case ENOPROTOOPT:
+		case EHOSTDOWN:
+		case ENONET:
+		case EHOSTUNREACH:
+		case EOPNOTSUPP:
+		case ENETUNREACH:
+			return true;
+		default:
+			return false;
+		}
+	}
 
 public:
-	server(std::string hostname, int port)
+	server(std::string hostname, int port, socket_options options = {})
+	    : options(options)
 	{
 		server_address.sin_family = AF_INET;
 		inet_pton(AF_INET, hostname.c_str(), &server_address.sin_addr);
 		server_address.sin_port = htons(port);
 	}
 
+	// Takes over a socket that's listening already, e.g. one handed over by
+	// another process.
+	server(int fd, socket_options options)
+	    : sock_fd(fd)
+	    , options(options)
+	{
+	}
+
 	~server()
 	{
 		close(sock_fd);
 	}
 
+	int native_handle() const { return sock_fd; }
+
 	void bind()
 	{
-		sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+		sock_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 		if (sock_fd < 0)
 			throw std::runtime_error(strerror(errno));
 
+		options.apply_listener(sock_fd);
+
 		int bindStatus = ::bind(sock_fd, (struct sockaddr*)&server_address, sizeof(server_address));
 		if (bindStatus < 0)
 			throw std::runtime_error(strerror(errno));
 	}
 
-	void listen(int max_connections)
+	// backlog from the socket options
+	void listen()
 	{
-		::listen(sock_fd, max_connections);
+		if (::listen(sock_fd, options.backlog) < 0)
+			throw std::runtime_error(strerror(errno));
 	}
 
-	conn accept()
+	template <class I = io::file_io, class... Args>
+	basic_conn<I> accept(Args... args)
 	{
 		sockaddr_in conn_addr {};
 		socklen_t conn_addr_size = sizeof(conn_addr);
@@ -63,7 +104,69 @@ public:
 		int conn_fd = ::accept(sock_fd, (struct sockaddr*)&conn_addr, &conn_addr_size);
 		if (conn_fd < 0)
 			throw std::runtime_error(strerror(errno));
-		return conn { conn_fd, conn_addr, conn_addr_size };
+		try {
+			options.apply(conn_fd);
+		} catch (...) {
+			close(conn_fd);
+			throw;
+		}
+		return basic_conn<I> { I(conn_fd, args...), conn_addr, conn_addr_size };
+	}
+
+	// Non-blocking accept for event loops, the accepted socket is non-blocking too.
+	// Connections that fail on the way in are skipped; throws only when the
+	// listener itself is stuck, e.g. out of fds (EMFILE, ENFILE) or memory.
+	template <class I = io::file_io, class... Args>
+	std::optional<basic_conn<I>> try_accept(Args... args)
+	{
+		for (;;) {
+			sockaddr_in conn_addr {};
+			socklen_t conn_addr_size = sizeof(conn_addr);
+
+			int conn_fd = ::accept4(sock_fd, (struct sockaddr*)&conn_addr, &conn_addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (conn_fd < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return std::nullopt;
+				if (transient(errno))
+					continue;
+				throw std::runtime_error(strerror(errno));
+			}
+			try {
+				options.apply(conn_fd);
+			} catch (std::runtime_error&) {
+				close(conn_fd);
+				continue;
+			}
+			return basic_conn<I> { I(conn_fd, args...), conn_addr, conn_addr_size };
+		}
+	}
+
+	// Accepts every incoming connection through a single multishot sqe.
+	// The ring has to be run by the caller, `on_accept` gets a basic_conn<io::uring_io>.
+	template <class F>
+	void accept_multishot(io::uring& ring, F on_accept)
+	{
+		ring.prep_accept_multishot(sock_fd, [this, &ring, on_accept](const io_uring_cqe& cqe) {
+			if (!(cqe.flags & IORING_CQE_F_MORE)) {
+				accept_multishot(ring, on_accept);
+			}
+			if (cqe.res < 0) {
+				return;
+			}
+
+			try {
+				options.apply(cqe.res);
+			} catch (std::runtime_error&) {
+				close(cqe.res);
+				return;
+			}
+
+			sockaddr_in conn_addr {};
+			socklen_t conn_addr_size = sizeof(conn_addr);
+			getpeername(cqe.res, (struct sockaddr*)&conn_addr, &conn_addr_size);
+			on_accept(basic_conn<io::uring_io> { io::uring_io(cqe.res, &ring), conn_addr, conn_addr_size });
+		});
+		ring.submit();
 	}
 };
 }
\ No newline at end of file
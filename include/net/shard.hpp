@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "net/event_loop.hpp"
+#include "net/server.hpp"
+#include "util/mpsc_queue.hpp"
+
+namespace net {
+
+// One worker of a runtime: a SO_REUSEPORT listener, an event loop and every
+// connection accepted on it. The mailbox is the only thing other threads touch.
+class shard {
+public:
+	using message = std::function<void(shard&)>;
+
+private:
+	unsigned id;
+	event_loop loop;
+	server listener;
+	mpsc_queue<message> mailbox;
+
+	// how long the listener stays out of the loop after running out of fds
+	static constexpr auto accept_backoff = std::chrono::milliseconds(100);
+	std::function<void()> accept_pending;
+	std::optional<event_loop::timer> backoff;
+
+	// every shard listens on the same address
+	static socket_options shared_port(socket_options options)
+	{
+		options.reuse_port = true;
+		return options;
+	}
+
+	void listen_for_accepts()
+	{
+		loop.add(listener.native_handle(), EPOLLIN, [this](uint32_t) { accept_pending(); });
+	}
+
+	void start()
+	{
+		fcntl(listener.native_handle(), F_SETFL, fcntl(listener.native_handle(), F_GETFL) | O_NONBLOCK);
+
+		loop.on_wake([this] {
+			while (auto m = mailbox.pop()) {
+				(*m)(*this);
+			}
+		});
+	}
+
+public:
+	shard(unsigned id, std::string hostname, int port, socket_options options = {})
+	    : id(id)
+	    , listener(hostname, port, shared_port(options))
+	{
+		listener.bind();
+		listener.listen();
+		start();
+	}
+
+	// Accepts on `fd`, a socket listening already.
+	shard(unsigned id, int fd, socket_options options = {})
+	    : id(id)
+	    , listener(fd, options)
+	{
+		start();
+	}
+
+	unsigned index() const { return id; }
+
+	event_loop& events() { return loop; }
+
+	// Safe to call from any thread, `m` runs on this shard's thread.
+	void post(message m)
+	{
+		mailbox.push(std::move(m));
+		loop.wake();
+	}
+
+	// Neither a failing connection nor running out of fds stops the shard:
+	// the listener waits in the backlog for a bit and takes it up again.
+	template <class F>
+	void run(F on_accept)
+	{
+		accept_pending = [this, on_accept] {
+			for (;;) {
+				std::optional<conn> c;
+				try {
+					c = listener.try_accept();
+				} catch (std::runtime_error& e) {
+					fprintf(stderr, "accept: %s, retrying in %lldms\n", e.what(), (long long)accept_backoff.count());
+					loop.remove(listener.native_handle());
+					backoff = loop.add_timer(accept_backoff, [this] {
+						backoff.reset();
+						listen_for_accepts();
+					});
+					return;
+				}
+				if (!c) {
+					return;
+				}
+				try {
+					on_accept(*this, std::move(*c));
+				} catch (std::exception& e) {
+					fprintf(stderr, "accept: %s\n", e.what());
+				}
+			}
+		};
+		listen_for_accepts();
+		loop.run();
+	}
+
+	int listener_handle() const { return listener.native_handle(); }
+
+	// Leaves the connections still to be accepted to whoever else listens
+	// on the socket. Call on this shard's thread.
+	void stop_accepting()
+	{
+		if (backoff) {
+			loop.cancel_timer(*backoff);
+			backoff.reset();
+		}
+		loop.remove(listener.native_handle());
+	}
+
+	void stop() { loop.stop(); }
+};
+
+// N shards, each on its own thread pinned to a core.
+class runtime {
+	std::vector<std::unique_ptr<shard>> shards;
+	std::vector<std::thread> threads;
+
+	static void pin(unsigned core)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core % std::thread::hardware_concurrency(), &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+public:
+	// Given `inherited` listening sockets, e.g. from the process this one
+	// replaces, there's one shard per socket instead of `count` new ones.
+	runtime(std::string hostname, int port, unsigned count = std::thread::hardware_concurrency(), socket_options options = {}, std::vector<int> inherited = {})
+	{
+		for (auto fd : inherited) {
+			shards.push_back(std::make_unique<shard>(shards.size(), fd, options));
+		}
+		for (unsigned i = 0; inherited.empty() && i < std::max(count, 1u); i++) {
+			shards.push_back(std::make_unique<shard>(i, hostname, port, options));
+		}
+	}
+
+	~runtime()
+	{
+		stop();
+		join();
+	}
+
+	size_t size() const { return shards.size(); }
+
+	shard& operator[](size_t i) { return *shards.at(i); }
+
+	// `on_accept(shard&, conn)` runs on the thread of the shard that accepted the connection.
+	template <class F>
+	void run(F on_accept)
+	{
+		for (auto& s : shards) {
+			threads.emplace_back([&s = *s, on_accept] {
+				pin(s.index());
+				s.run(on_accept);
+			});
+		}
+	}
+
+	// Runs `m` once on every shard.
+	void broadcast(shard::message m)
+	{
+		for (auto& s : shards) {
+			s->post(m);
+		}
+	}
+
+	void stop()
+	{
+		for (auto& s : shards) {
+			s->stop();
+		}
+	}
+
+	void join()
+	{
+		for (auto& t : threads) {
+			if (t.joinable())
+				t.join();
+		}
+	}
+};
+
+}
\ No newline at end of file
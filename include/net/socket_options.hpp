@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace net {
+
+// Options applied to the sockets a net::server or net::client creates.
+struct socket_options {
+	// listening sockets only
+	bool reuse_addr = true;
+	// lets several listening sockets (one per shard) share the address,
+	// the kernel then spreads incoming connections across them
+	bool reuse_port = false;
+	int backlog = SOMAXCONN;
+
+	// connected sockets
+	bool no_delay = true;
+	// the kernel clears it again after a while, so it only speeds up the first acks
+	bool quick_ack = false;
+	std::optional<int> send_buffer;
+	std::optional<int> recv_buffer;
+
+	// small frames out right away, pair with flush_mode::latency
+	static socket_options latency()
+	{
+		socket_options o;
+		o.no_delay = true;
+		o.quick_ack = true;
+		return o;
+	}
+
+	// bigger buffers, pair with flush_mode::throughput. Nagle stays off:
+	// the batching already happens in user space, and Nagle on top of it
+	// stalls on delayed acks.
+	static socket_options throughput()
+	{
+		socket_options o;
+		o.no_delay = true;
+		o.send_buffer = 1 << 20;
+		o.recv_buffer = 1 << 20;
+		return o;
+	}
+
+	void apply_listener(int fd) const
+	{
+		set(fd, SOL_SOCKET, SO_REUSEADDR, reuse_addr);
+		if (reuse_port) {
+			set(fd, SOL_SOCKET, SO_REUSEPORT, 1);
+		}
+		// inherited by accepted sockets, has to be set before listen() to affect the window
+		buffers(fd);
+	}
+
+	void apply(int fd) const
+	{
+		set(fd, IPPROTO_TCP, TCP_NODELAY, no_delay);
+		if (quick_ack) {
+			set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+		}
+		buffers(fd);
+	}
+
+private:
+	static void set(int fd, int level, int name, int value)
+	{
+		if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+			throw std::runtime_error(strerror(errno));
+	}
+
+	void buffers(int fd) const
+	{
+		if (send_buffer)
+			set(fd, SOL_SOCKET, SO_SNDBUF, *send_buffer);
+		if (recv_buffer)
+			set(fd, SOL_SOCKET, SO_RCVBUF, *recv_buffer);
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "net/packet.hpp"
+#include "net/types.hpp"
+
+namespace net {
+
+// conn.hpp includes this one, through interest_filter.hpp
+template <class I>
+class basic_conn;
+
+enum class entity_kind : uint8_t {
+	player,
+	npc,
+	projectile,
+	item,
+};
+
+// Where the players, NPCs, projectiles and items a connection hears about
+// are, for radius and rectangle queries that only look at nearby cells.
+//
+// Positions are in pixels (16 per tile). The plane is cut in square cells
+// hashed into a fixed number of buckets, so any coordinate works and
+// memory doesn't depend on the world size. Entities live in one dense
+// array; a bucket only holds indices into it. Not thread safe: one per
+// connection, like the coalescer.
+class spatial_grid {
+public:
+	struct entity {
+		entity_kind kind;
+		uint32_t id;
+		float x;
+		float y;
+	};
+
+private:
+	struct slot {
+		entity e;
+		uint32_t bucket;
+		// position in that bucket
+		uint32_t index;
+	};
+
+	float cell;
+	uint32_t mask;
+	std::vector<slot> entities;
+	std::vector<std::vector<uint32_t>> buckets;
+	std::unordered_map<uint64_t, uint32_t> lookup;
+
+	static uint64_t key(entity_kind kind, uint32_t id) { return uint64_t(kind) << 32 | id; }
+
+	int32_t cell_of(float v) const
+	{
+		// NaN and far off positions end up at the edge instead of overflowing
+		auto c = std::floor(v / cell);
+		return c >= INT32_MAX ? INT32_MAX : c > INT32_MIN ? int32_t(c) : INT32_MIN;
+	}
+
+	uint32_t bucket_of(int32_t cx, int32_t cy) const
+	{
+		return (uint32_t(cx) * 73856093u ^ uint32_t(cy) * 19349663u) & mask;
+	}
+
+	void link(uint32_t i)
+	{
+		auto& s = entities[i];
+		s.bucket = bucket_of(cell_of(s.e.x), cell_of(s.e.y));
+		s.index = buckets[s.bucket].size();
+		buckets[s.bucket].push_back(i);
+	}
+
+	void unlink(uint32_t i)
+	{
+		auto& s = entities[i];
+		auto& b = buckets[s.bucket];
+		b[s.index] = b.back();
+		entities[b[s.index]].index = s.index;
+		b.pop_back();
+	}
+
+	// Calls `f(const entity&)` for the entities of cells [cx0, cx1] x [cy0, cy1]
+	// inside the rectangle.
+	template <class F>
+	void visit(float x0, float y0, float x1, float y1, F& f) const
+	{
+		auto cx0 = cell_of(x0), cx1 = cell_of(x1);
+		auto cy0 = cell_of(y0), cy1 = cell_of(y1);
+		auto inside = [&](const entity& e) { return e.x >= x0 && e.x <= x1 && e.y >= y0 && e.y <= y1; };
+
+		// more cells than buckets, cheaper to look at everything
+		if ((uint64_t(int64_t(cx1) - cx0) + 1) * (uint64_t(int64_t(cy1) - cy0) + 1) > buckets.size()) {
+			for (auto& s : entities) {
+				if (inside(s.e)) {
+					f(s.e);
+				}
+			}
+			return;
+		}
+
+		for (auto cx = int64_t(cx0); cx <= cx1; cx++) {
+			for (auto cy = int64_t(cy0); cy <= cy1; cy++) {
+				for (auto i : buckets[bucket_of(cx, cy)]) {
+					auto& e = entities[i].e;
+					// other cells hash to the same bucket too
+					if (cell_of(e.x) == cx && cell_of(e.y) == cy && inside(e)) {
+						f(e);
+					}
+				}
+			}
+		}
+	}
+
+public:
+	// `cell_size` in pixels, `bucket_count` a power of two.
+	explicit spatial_grid(float cell_size = 512, uint32_t bucket_count = 1024)
+	    : cell(cell_size)
+	    , mask(bucket_count - 1)
+	    , buckets(bucket_count)
+	{
+		assert(bucket_count > 0 && (bucket_count & mask) == 0);
+	}
+
+	size_t size() const { return entities.size(); }
+
+	// Adds the entity or moves it.
+	void update(entity_kind kind, uint32_t id, float x, float y)
+	{
+		auto [it, inserted] = lookup.try_emplace(key(kind, id), entities.size());
+		if (inserted) {
+			entities.push_back({ { kind, id, x, y }, 0, 0 });
+			link(it->second);
+			return;
+		}
+
+		auto i = it->second;
+		auto& s = entities[i];
+		auto moved_cell = cell_of(s.e.x) != cell_of(x) || cell_of(s.e.y) != cell_of(y);
+		if (moved_cell) {
+			unlink(i);
+		}
+		s.e.x = x;
+		s.e.y = y;
+		if (moved_cell) {
+			link(i);
+		}
+	}
+
+	bool remove(entity_kind kind, uint32_t id)
+	{
+		auto it = lookup.find(key(kind, id));
+		if (it == lookup.end()) {
+			return false;
+		}
+		auto i = it->second;
+		lookup.erase(it);
+		unlink(i);
+
+		// keep the array dense, the last entity takes the freed place
+		auto last = uint32_t(entities.size() - 1);
+		if (i != last) {
+			unlink(last);
+			entities[i] = entities[last];
+			link(i);
+			lookup[key(entities[i].e.kind, entities[i].e.id)] = i;
+		}
+		entities.pop_back();
+		return true;
+	}
+
+	void clear()
+	{
+		entities.clear();
+		lookup.clear();
+		for (auto& b : buckets) {
+			b.clear();
+		}
+	}
+
+	std::optional<entity> find(entity_kind kind, uint32_t id) const
+	{
+		auto it = lookup.find(key(kind, id));
+		if (it == lookup.end()) {
+			return std::nullopt;
+		}
+		return entities[it->second].e;
+	}
+
+	// Calls `f(const entity&)` for every entity inside the rectangle.
+	template <class F>
+	void query_rect(float x0, float y0, float x1, float y1, F f) const
+	{
+		visit(x0, y0, x1, y1, f);
+	}
+
+	// Calls `f(const entity&)` for every entity within `radius` of (x, y).
+	template <class F>
+	void query_radius(float x, float y, float radius, F f) const
+	{
+		auto within = [&](const entity& e) {
+			auto dx = e.x - x, dy = e.y - y;
+			if (dx * dx + dy * dy <= radius * radius) {
+				f(e);
+			}
+		};
+		visit(x - radius, y - radius, x + radius, y + radius, within);
+	}
+
+	// Projectile ids are only unique per owner.
+	static uint32_t projectile_key(uint8_t owner, int16_t id) { return uint32_t(owner) << 16 | uint16_t(id); }
+
+	// Keeps the grid up to date from what `c` receives, usually a backend
+	// connection. Register it before handlers that consume packets.
+	template <class I>
+	void observe(basic_conn<I>& c)
+	{
+		using namespace packet;
+
+		c.template reg_handler<player_controls>([this](player_controls& p) {
+			update(entity_kind::player, p.client_id, p.position.x, p.position.y);
+			return false;
+		});
+		c.template reg_handler<spawn_player>([this](spawn_player& p) {
+			// -1 for the world spawn, the next player_controls tells where that is
+			if (p.spawn_x >= 0 && p.spawn_y >= 0) {
+				update(entity_kind::player, p.client_id, p.spawn_x * 16.f, p.spawn_y * 16.f);
+			}
+			return false;
+		});
+		c.template reg_handler<player_active>([this](player_active& p) {
+			if (!p.active) {
+				remove(entity_kind::player, p.client_id);
+			}
+			return false;
+		});
+		c.reg_handler(npc_update::packet_id, [this](std::span<uint8_t> payload) {
+			npc_update n;
+			if (!try_decode_packet(payload, n)) {
+				return false;
+			}
+			if (npc_update_alive(payload).value_or(true)) {
+				update(entity_kind::npc, uint16_t(n.npc_id), n.position.x, n.position.y);
+			} else {
+				remove(entity_kind::npc, uint16_t(n.npc_id));
+			}
+			return false;
+		});
+		c.template reg_handler<projectile_update>([this](projectile_update& p) {
+			update(entity_kind::projectile, projectile_key(p.owner, p.projectile_id), p.position.x, p.position.y);
+			return false;
+		});
+		c.template reg_handler<kill_projectile>([this](kill_projectile& p) {
+			remove(entity_kind::projectile, projectile_key(p.owner, p.projectile_id));
+			return false;
+		});
+		c.template reg_handler<drop_item>([this](drop_item& d) {
+			// an item type of 0 takes it out of the world
+			if (d.new_id == 0 || d.stack == 0) {
+				remove(entity_kind::item, uint16_t(d.old_id));
+			} else {
+				update(entity_kind::item, uint16_t(d.old_id), d.position.x, d.position.y);
+			}
+			return false;
+		});
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace net {
+
+// Lazily started coroutine, resumed by the event loop through the awaiters
+// of basic_conn (expect, send). Lets a whole handshake read top to bottom:
+//
+//	net::task<> join(net::conn& c)
+//	{
+//		co_await c.send(net::packet::conn_request { "Terraria279" });
+//		auto a = co_await c.expect<net::packet::accept>();
+//		...
+//		auto info = co_await c.expect<net::packet::world_info>();
+//	}
+template <class T = void>
+class task;
+
+namespace detail {
+
+struct final_awaiter {
+	bool await_ready() noexcept { return false; }
+
+	template <class P>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+	{
+		auto c = h.promise().continuation;
+		return c ? c : std::noop_coroutine();
+	}
+
+	void await_resume() noexcept { }
+};
+
+template <class T>
+struct promise_base {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { error = std::current_exception(); }
+};
+
+}
+
+template <class T>
+class task {
+public:
+	struct promise_type : detail::promise_base<T> {
+		std::optional<T> value;
+
+		task get_return_object() { return task { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+
+		void return_value(T v) { value.emplace(std::move(v)); }
+	};
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+	explicit task(std::coroutine_handle<promise_type> h)
+	    : handle(h)
+	{
+	}
+
+public:
+	task(task&& t)
+	    : handle(std::exchange(t.handle, nullptr))
+	{
+	}
+
+	task(const task&) = delete;
+
+	~task()
+	{
+		if (handle)
+			handle.destroy();
+	}
+
+	bool await_ready() { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+	{
+		handle.promise().continuation = h;
+		return handle;
+	}
+
+	T await_resume()
+	{
+		if (handle.promise().error)
+			std::rethrow_exception(handle.promise().error);
+		return std::move(*handle.promise().value);
+	}
+};
+
+template <>
+class task<void> {
+public:
+	struct promise_type : detail::promise_base<void> {
+		task get_return_object() { return task { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+
+		void return_void() { }
+	};
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+	explicit task(std::coroutine_handle<promise_type> h)
+	    : handle(h)
+	{
+	}
+
+public:
+	task(task&& t)
+	    : handle(std::exchange(t.handle, nullptr))
+	{
+	}
+
+	task(const task&) = delete;
+
+	~task()
+	{
+		if (handle)
+			handle.destroy();
+	}
+
+	bool await_ready() { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+	{
+		handle.promise().continuation = h;
+		return handle;
+	}
+
+	void await_resume()
+	{
+		if (handle.promise().error)
+			std::rethrow_exception(handle.promise().error);
+	}
+};
+
+namespace detail {
+
+struct detached {
+	struct promise_type {
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() { }
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+}
+
+// Starts `t` right away; it runs until its first suspension and then on
+// whatever resumes it. Its frame is freed once it finishes.
+inline detail::detached spawn(task<> t, std::function<void(std::exception_ptr)> on_error = {})
+{
+	try {
+		co_await t;
+	} catch (...) {
+		if (on_error)
+			on_error(std::current_exception());
+	}
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace net {
+
+// Hierarchical timer wheel with millisecond ticks: 4 levels of 64 slots,
+// each slot an intrusive list, so arming and cancelling are O(1) and
+// advancing only touches slots that are due. Timers further out than the
+// top level reaches (~4.6h) wait there and get cascaded again.
+class timer_wheel {
+public:
+	using clock = std::chrono::steady_clock;
+
+	// Handle of an armed timer, stays safe to cancel after it fired.
+	struct timer {
+		uint32_t index = nil;
+		uint32_t generation = 0;
+	};
+
+private:
+	static constexpr uint32_t nil = std::numeric_limits<uint32_t>::max();
+	static constexpr int levels = 4;
+	static constexpr int slot_bits = 6;
+	static constexpr uint64_t slots = 1 << slot_bits;
+	static constexpr uint64_t slot_mask = slots - 1;
+
+	struct node {
+		std::function<void()> cb;
+		uint64_t expiry;
+		uint32_t prev;
+		uint32_t next;
+		uint32_t generation = 0;
+		uint8_t level;
+		uint8_t slot;
+		bool armed = false;
+	};
+
+	clock::time_point start;
+	uint64_t now_tick = 0;
+
+	std::vector<node> nodes;
+	std::vector<uint32_t> free_nodes;
+	size_t armed = 0;
+
+	std::array<std::array<uint32_t, slots>, levels> heads;
+	// bit i set when slot i of a level isn't empty
+	std::array<uint64_t, levels> occupied {};
+
+	uint64_t ticks(clock::time_point t) const
+	{
+		if (t <= start) {
+			return 0;
+		}
+		return std::chrono::duration_cast<std::chrono::milliseconds>(t - start).count();
+	}
+
+	void link(uint32_t i)
+	{
+		auto& n = nodes[i];
+		auto delta = n.expiry > now_tick ? n.expiry - now_tick : 0;
+
+		int level = 0;
+		while (level < levels - 1 && delta >= uint64_t(1) << (slot_bits * (level + 1))) {
+			level++;
+		}
+		auto expiry = std::min(n.expiry, now_tick + (uint64_t(1) << (slot_bits * levels)) - 1);
+		auto slot = (expiry >> (slot_bits * level)) & slot_mask;
+
+		n.level = level;
+		n.slot = slot;
+		n.prev = nil;
+		n.next = heads[level][slot];
+		if (n.next != nil) {
+			nodes[n.next].prev = i;
+		}
+		heads[level][slot] = i;
+		occupied[level] |= uint64_t(1) << slot;
+	}
+
+	void unlink(uint32_t i)
+	{
+		auto& n = nodes[i];
+		if (n.prev != nil) {
+			nodes[n.prev].next = n.next;
+		} else {
+			heads[n.level][n.slot] = n.next;
+		}
+		if (n.next != nil) {
+			nodes[n.next].prev = n.prev;
+		}
+		if (heads[n.level][n.slot] == nil) {
+			occupied[n.level] &= ~(uint64_t(1) << n.slot);
+		}
+	}
+
+	void release(uint32_t i)
+	{
+		nodes[i].armed = false;
+		nodes[i].generation++;
+		free_nodes.push_back(i);
+		armed--;
+	}
+
+	// Moves the timers of the slot `level` just reached one level down.
+	void cascade(int level)
+	{
+		auto slot = (now_tick >> (slot_bits * level)) & slot_mask;
+		while (heads[level][slot] != nil) {
+			auto i = heads[level][slot];
+			unlink(i);
+			link(i);
+		}
+	}
+
+	void tick()
+	{
+		now_tick++;
+
+		// from the top, so timers can fall through several levels at once
+		int top = 0;
+		while (top + 1 < levels && (now_tick & ((uint64_t(1) << (slot_bits * (top + 1))) - 1)) == 0) {
+			top++;
+		}
+		for (int level = top; level > 0; level--) {
+			cascade(level);
+		}
+
+		auto slot = now_tick & slot_mask;
+		while (heads[0][slot] != nil) {
+			auto i = heads[0][slot];
+			unlink(i);
+			auto cb = std::move(nodes[i].cb);
+			release(i);
+			cb();
+		}
+	}
+
+public:
+	timer_wheel(clock::time_point start = clock::now())
+	    : start(start)
+	{
+		for (auto& level : heads) {
+			level.fill(nil);
+		}
+	}
+
+	size_t size() const { return armed; }
+
+	// `cb` runs from advance() once `deadline` passed, at the earliest on the next tick.
+	timer add(clock::time_point deadline, std::function<void()> cb)
+	{
+		uint32_t i;
+		if (!free_nodes.empty()) {
+			i = free_nodes.back();
+			free_nodes.pop_back();
+		} else {
+			i = nodes.size();
+			nodes.emplace_back();
+		}
+
+		auto& n = nodes[i];
+		n.cb = std::move(cb);
+		n.expiry = std::max(ticks(deadline), now_tick + 1);
+		n.armed = true;
+		armed++;
+		link(i);
+
+		return { i, n.generation };
+	}
+
+	// False if `t` already fired or was cancelled.
+	bool cancel(timer t)
+	{
+		if (t.index >= nodes.size() || nodes[t.index].generation != t.generation || !nodes[t.index].armed) {
+			return false;
+		}
+		unlink(t.index);
+		nodes[t.index].cb = nullptr;
+		release(t.index);
+		return true;
+	}
+
+	// Runs every timer due by `now`.
+	void advance(clock::time_point now)
+	{
+		auto target = ticks(now);
+		while (now_tick < target) {
+			if (armed == 0) {
+				now_tick = target;
+				break;
+			}
+			// nothing to fire before the next cascade, skip to it
+			if (occupied[0] == 0) {
+				now_tick = std::min(target - 1, now_tick | slot_mask);
+			}
+			tick();
+		}
+	}
+
+	// Time until advance() has something to do: the earliest due level 0
+	// slot or cascade. std::nullopt when no timer is armed.
+	std::optional<clock::duration> next_expiry(clock::time_point now) const
+	{
+		if (armed == 0) {
+			return std::nullopt;
+		}
+
+		auto next = std::numeric_limits<uint64_t>::max();
+		for (int level = 0; level < levels; level++) {
+			if (occupied[level] == 0) {
+				continue;
+			}
+			auto shift = slot_bits * level;
+			auto current = (now_tick >> shift) & slot_mask;
+			auto distance = std::countr_zero(std::rotr(occupied[level], int((current + 1) & slot_mask))) + 1;
+			next = std::min(next, ((now_tick >> shift) + distance) << shift);
+		}
+
+		auto elapsed = ticks(now);
+		auto wait = next > elapsed ? next - elapsed : 0;
+		return std::chrono::milliseconds(wait);
+	}
+};
+
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <concepts>
 #include <cstdint>
 #include <cstring>
 #include <string>
@@ -22,9 +23,35 @@ concept packet = requires(T x) { x.packet_id; };
 template <class T>
 concept compressed_packet = packet<T> && requires(T x) { x.compressed; };
 
+template <class T>
+concept droppable_packet = packet<T> && requires(T x) { x.droppable; };
+
+template <class T>
+concept player_packet = packet<T> && requires(T x) { { x.client_id } -> std::same_as<uint8_t&>; };
+
+// only the latest one per player matters, see net::coalescer
+template <class T>
+concept coalesced_packet = player_packet<T> && requires(T x) { x.coalesce; };
+
+// only the leading fields are modelled, decoding skips the rest of the payload
+template <class T>
+concept partial_packet = packet<T> && requires(T x) { x.partial; };
+
 template <class T>
 concept netmodule = requires(T x) { x.module_id; };
 
+// only clients send it, see packet::direction
+template <class T>
+concept server_bound_packet = (packet<T> || netmodule<T>) && requires(T x) { x.to_server; };
+
+// only servers send it
+template <class T>
+concept client_bound_packet = (packet<T> || netmodule<T>) && requires(T x) { x.to_client; };
+
+// netmodules travel inside this packet, prefixed by their uint16 module id
+constexpr uint8_t netmodule_packet_id = 82;
+constexpr uint16_t max_netmodules = 64;
+
 struct nstring {
 	enum ns_type : uint8_t {
 		Literal,
@@ -47,7 +74,7 @@ struct nstring {
 		offset += io.read(subs_len);
 		if (subs_len > 0) {
 			substitutions.resize(subs_len);
-			io.read(substitutions);
+			offset += io.read(substitutions);
 		}
 		
 		return offset;
@@ -101,18 +128,21 @@ struct death_reason {
 
 struct conn_request {
 	static constexpr uint8_t packet_id = 1;
+	static constexpr packet_flag to_server {};
 
 	std::string ver;
 };
 
 struct disconnect {
 	static constexpr uint8_t packet_id = 2;
+	static constexpr packet_flag to_client {};
 
 	nstring reason;
 };
 
 struct accept {
 	static constexpr uint8_t packet_id = 3;
+	static constexpr packet_flag to_client {};
 
 	std::uint8_t client_id;
 	uint8_t _ = 0;
@@ -152,10 +182,12 @@ struct player_inventory_slot {
 
 struct request_world_data {
 	static constexpr uint8_t packet_id = 6;
+	static constexpr packet_flag to_server {};
 };
 
 struct world_info {
 	static constexpr uint8_t packet_id = 7;
+	static constexpr packet_flag to_client {};
 
 	// FIXME: i'm not sure this struct is correct
 	int32_t time;
@@ -194,12 +226,15 @@ struct world_info {
 
 struct request_tiles_at {
 	static constexpr uint8_t packet_id = 8;
+	static constexpr packet_flag to_server {};
 	int32_t spawn_x;
 	int32_t spawn_y;
 };
 
 struct statusbar_text {
 	static constexpr uint8_t packet_id = 9;
+	static constexpr packet_flag to_client {};
+	static constexpr packet_flag droppable {};
 
 	int32_t status_max;
 	nstring status_text;
@@ -208,6 +243,7 @@ struct statusbar_text {
 
 struct send_tile_data {
 	static constexpr uint8_t packet_id = 10;
+	static constexpr packet_flag to_client {};
 	static constexpr packet_flag compressed {};
 
 	// FIXME: implement
@@ -226,14 +262,76 @@ struct spawn_player {
 	uint8_t spwan_context;
 };
 
+struct player_controls {
+	static constexpr uint8_t packet_id = 13;
+	// velocity and return positions follow, depending on the flags
+	static constexpr packet_flag partial {};
+
+	uint8_t client_id;
+	uint8_t control;
+	uint8_t pulley;
+	uint8_t misc;
+	uint8_t sleeping;
+	uint8_t selected_item;
+	vec2<float> position;
+};
+
+struct player_active {
+	static constexpr uint8_t packet_id = 14;
+	static constexpr packet_flag to_client {};
+
+	uint8_t client_id;
+	bool active;
+};
+
 struct player_health {
 	static constexpr uint8_t packet_id = 16;
+	static constexpr packet_flag droppable {};
+	static constexpr packet_flag coalesce {};
 
 	uint8_t client_id;
 	uint16_t current;
 	uint16_t max;
 };
 
+struct tile_manipulation {
+	static constexpr uint8_t packet_id = 17;
+
+	enum kind : uint8_t {
+		kill_tile,
+		place_tile,
+		kill_wall,
+		place_wall,
+		kill_tile_no_item,
+		place_wire,
+		kill_wire,
+		pound_tile,
+		place_actuator,
+		kill_actuator,
+		place_wire2,
+		kill_wire2,
+		place_wire3,
+		kill_wire3,
+		slope_tile,
+		frame_track,
+		place_wire4,
+		kill_wire4,
+		poke_logic_gate,
+		actuate,
+		try_kill_tile,
+		replace_tile,
+		replace_wall,
+		slope_pound_tile,
+	};
+
+	uint8_t action;
+	int16_t x;
+	int16_t y;
+	// tile or wall type, slope, or 1 if a kill only damages
+	int16_t value;
+	uint8_t style;
+};
+
 struct drop_item {
 	static constexpr uint8_t packet_id = 21;
 
@@ -248,8 +346,42 @@ struct drop_item {
 	int16_t new_id;
 };
 
+struct npc_update {
+	static constexpr uint8_t packet_id = 23;
+	static constexpr packet_flag to_client {};
+	// flags, ai, type and life follow, see npc_update_alive()
+	static constexpr packet_flag partial {};
+
+	int16_t npc_id;
+	vec2<float> position;
+	vec2<float> velocity;
+	uint16_t target;
+};
+
+struct projectile_update {
+	static constexpr uint8_t packet_id = 27;
+	// ai and the other flag dependent fields follow
+	static constexpr packet_flag partial {};
+
+	// unique per owner, not globally
+	int16_t projectile_id;
+	vec2<float> position;
+	vec2<float> velocity;
+	uint8_t owner;
+	int16_t type;
+};
+
+struct kill_projectile {
+	static constexpr uint8_t packet_id = 29;
+
+	int16_t projectile_id;
+	uint8_t owner;
+};
+
 struct player_zones {
 	static constexpr uint8_t packet_id = 36;
+	static constexpr packet_flag droppable {};
+	static constexpr packet_flag coalesce {};
 
 	uint8_t client_id;
 	uint32_t zone_flags;
@@ -258,16 +390,20 @@ struct player_zones {
 
 struct request_password {
 	static constexpr uint8_t packet_id = 37;
+	static constexpr packet_flag to_client {};
 };
 
 struct send_password {
 	static constexpr uint8_t packet_id = 38;
+	static constexpr packet_flag to_server {};
 
 	std::string password;
 };
 
 struct player_mana {
 	static constexpr uint8_t packet_id = 42;
+	static constexpr packet_flag droppable {};
+	static constexpr packet_flag coalesce {};
 
 	uint8_t client_id;
 	uint16_t current;
@@ -276,10 +412,13 @@ struct player_mana {
 
 struct initial_spawn_player {
 	static constexpr uint8_t packet_id = 49;
+	static constexpr packet_flag to_client {};
 };
 
 struct update_player_buffs {
 	static constexpr uint8_t packet_id = 50;
+	static constexpr packet_flag droppable {};
+	static constexpr packet_flag coalesce {};
 
 	uint8_t client_id;
 	std::array<uint16_t, max_buffs> buffs;
@@ -287,6 +426,7 @@ struct update_player_buffs {
 
 struct world_evil {
 	static constexpr uint8_t packet_id = 57;
+	static constexpr packet_flag to_client {};
 
 	uint8_t good;
 	uint8_t evil;
@@ -295,12 +435,14 @@ struct world_evil {
 
 struct player_uuid {
 	static constexpr uint8_t packet_id = 68;
+	static constexpr packet_flag to_server {};
 
 	std::string uuid;
 };
 
 struct npc_kill_count {
 	static constexpr uint8_t packet_id = 83;
+	static constexpr packet_flag to_client {};
 
 	uint16_t npc_type;
 	uint32_t npc_kill_count;
@@ -308,21 +450,26 @@ struct npc_kill_count {
 
 struct tower_powers {
 	static constexpr uint8_t packet_id = 101;
+	static constexpr packet_flag to_client {};
+	static constexpr packet_flag droppable {};
 	uint16_t solar, nebula, vertex, stardust;
 };
 
 struct connection_completed {
 	static constexpr uint8_t packet_id = 129;
+	static constexpr packet_flag to_client {};
 };
 
 struct monster_types {
 	static constexpr uint8_t packet_id = 136;
+	static constexpr packet_flag to_client {};
 
 	std::array<std::array<uint16_t, 3>, 2> types;
 };
 
 struct player_loadout {
 	static constexpr uint8_t packet_id = 147;
+	static constexpr packet_flag coalesce {};
 
 	uint8_t client_id;
 	uint8_t index;
@@ -344,11 +491,21 @@ struct damage_player {
 
 struct client_text {
 	static constexpr uint8_t module_id = 1;
+	static constexpr packet_flag to_client {};
     
 	nstring command;
     nstring text;
 };
 
+// what a client types into chat, commands included
+struct chat_message {
+	static constexpr uint8_t module_id = 1;
+	static constexpr packet_flag to_server {};
+
+	std::string command;
+	std::string text;
+};
+
 inline nstring operator""_ns(const char* str, std::size_t)
 {
 	return nstring{nstring::Literal, str};
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "file/tile.hpp"
+#include "file/world.hpp"
+#include "net/conn.hpp"
+#include "net/packet.hpp"
+#include "net/types.hpp"
+#include "util/profile.hpp"
+
+namespace net {
+
+// Copy of a server's tiles kept up to date from the packets passing
+// through, so queries (region dumps, protection checks, map rendering)
+// don't have to bother the server. Starts from a .wld snapshot or empty,
+// to be filled by the sections the server sends (packet 10).
+//
+// The world is split in chunks the size of Terraria's sections; each one
+// remembers the version of the last change to it, so readers can tell
+// what changed since they last looked. Any thread may read or apply.
+//
+// snapshot() copies the world for backups while changes keep coming in,
+// see there.
+class world_mirror {
+public:
+	static constexpr int32_t chunk_width = 200;
+	static constexpr int32_t chunk_height = 150;
+
+	static constexpr uint8_t send_section_id = packet::send_tile_data::packet_id;
+	static constexpr uint8_t tile_square_id = 20;
+
+private:
+	mutable std::shared_mutex lock;
+	file::tiles grid;
+	file::tile_importance importance;
+
+	int32_t chunks_x;
+	int32_t chunks_y;
+	std::vector<uint64_t> chunk_versions;
+	uint64_t latest = 0;
+
+	// the copy a snapshot() in progress makes, chunk by chunk
+	struct capture {
+		file::tiles grid;
+		std::vector<bool> copied;
+	};
+	std::unique_ptr<capture> capturing;
+	std::mutex snapshotting;
+
+	// Calls `f(chunk index)` for the chunks a rectangle overlaps, clipped to
+	// the world.
+	template <class F>
+	void for_chunks(int32_t x, int32_t y, int32_t width, int32_t height, F f) const
+	{
+		auto x0 = std::max(x, 0) / chunk_width, y0 = std::max(y, 0) / chunk_height;
+		auto x1 = std::min(x + width, grid.width()), y1 = std::min(y + height, grid.height());
+		if (x1 <= 0 || y1 <= 0) {
+			return;
+		}
+
+		for (auto cx = x0; cx <= (x1 - 1) / chunk_width; cx++) {
+			for (auto cy = y0; cy <= (y1 - 1) / chunk_height; cy++) {
+				f(size_t(cx) * chunks_y + cy);
+			}
+		}
+	}
+
+	// Caller holds the lock exclusively.
+	void touch(int32_t x, int32_t y, int32_t width, int32_t height)
+	{
+		latest++;
+		for_chunks(x, y, width, height, [this](size_t c) { chunk_versions[c] = latest; });
+	}
+
+	// Copies chunk `c` into the snapshot being taken, unless it's there
+	// already. Caller holds the lock exclusively.
+	void copy_chunk(size_t c)
+	{
+		if (capturing->copied[c]) {
+			return;
+		}
+		capturing->copied[c] = true;
+
+		int32_t x0 = c / chunks_y * chunk_width, y0 = c % chunks_y * chunk_height;
+		auto x1 = std::min(x0 + chunk_width, grid.width()), y1 = std::min(y0 + chunk_height, grid.height());
+		for (auto x = x0; x < x1; x++) {
+			// columns are contiguous
+			std::copy_n(&grid.at(x, y0), y1 - y0, &capturing->grid.at(x, y0));
+		}
+	}
+
+	// To be called before changing a rectangle, so a snapshot in progress
+	// keeps what was there. Caller holds the lock exclusively.
+	void preserve(int32_t x, int32_t y, int32_t width, int32_t height)
+	{
+		if (capturing) {
+			for_chunks(x, y, width, height, [this](size_t c) { copy_chunk(c); });
+		}
+	}
+
+	// One tile of a tile square (packet 20).
+	template <class I>
+	void read_square_tile(io::serialized_io<I>& rd, file::tile& t)
+	{
+		using file::tile;
+		uint8_t b1, b2, b3;
+		rd.read(b1);
+		rd.read(b2);
+		rd.read(b3);
+
+		auto was = t;
+		t = tile {};
+		t.set(tile::active, b1 & 1);
+		t.set(tile::wire, b1 & 16);
+		t.set(tile::half_brick, b1 & 32);
+		t.set(tile::actuator, b1 & 64);
+		t.set(tile::inactive, b1 & 128);
+		t.set(tile::wire2, b2 & 1);
+		t.set(tile::wire3, b2 & 2);
+		t.set(tile::wire4, b2 & 128);
+		t.set(tile::fullbright_block, b3 & 1);
+		t.set(tile::fullbright_wall, b3 & 2);
+		t.set(tile::invisible_block, b3 & 4);
+		t.set(tile::invisible_wall, b3 & 8);
+
+		if (b2 & 4) {
+			rd.read(t.color);
+		}
+		if (b2 & 8) {
+			rd.read(t.wall_color);
+		}
+		if (t.has(tile::active)) {
+			rd.read(t.type);
+			if (file::frame_important(importance, t.type)) {
+				rd.read(t.frame_x);
+				rd.read(t.frame_y);
+			} else if (was.has(tile::active) && was.type == t.type) {
+				t.frame_x = was.frame_x;
+				t.frame_y = was.frame_y;
+			}
+			t.slope = (b2 >> 4) & 7;
+		}
+		if (b1 & 4) {
+			rd.read(t.wall);
+		}
+		if (b1 & 8) {
+			rd.read(t.liquid);
+			rd.read(t.liquid_type);
+		}
+	}
+
+public:
+	// An empty world of the given size, e.g. world_info's max_tiles_x/y.
+	// `importance` has to match the server's tile types.
+	world_mirror(int32_t width, int32_t height, file::tile_importance importance)
+	    : grid(width, height)
+	    , importance(std::move(importance))
+	    , chunks_x((width + chunk_width - 1) / chunk_width)
+	    , chunks_y((height + chunk_height - 1) / chunk_height)
+	    , chunk_versions(size_t(chunks_x) * chunks_y)
+	{
+	}
+
+	// Starts from the server's world file.
+	explicit world_mirror(const file::world& w)
+	    : world_mirror(w.width(), w.height(), w.importance())
+	{
+		grid = w.load_tiles();
+	}
+
+	int32_t width() const { return grid.width(); }
+	int32_t height() const { return grid.height(); }
+
+	std::optional<file::tile> at(int32_t x, int32_t y) const
+	{
+		std::shared_lock l(lock);
+		if (!grid.contains(x, y)) {
+			return std::nullopt;
+		}
+		return grid.at(x, y);
+	}
+
+	// Copy of a rectangle, clipped to the world.
+	file::tiles region(int32_t x, int32_t y, int32_t width, int32_t height) const
+	{
+		std::shared_lock l(lock);
+		return grid.region(x, y, width, height);
+	}
+
+	// Runs `f(const file::tiles&)` with no change applied meanwhile.
+	template <class F>
+	auto read(F f) const
+	{
+		std::shared_lock l(lock);
+		return f(grid);
+	}
+
+	// Version of the latest change, 0 before the first one.
+	uint64_t version() const
+	{
+		std::shared_lock l(lock);
+		return latest;
+	}
+
+	// Indices (x * chunks_y + y) of the chunks changed after `since`.
+	std::vector<size_t> changed_since(uint64_t since) const
+	{
+		std::shared_lock l(lock);
+		std::vector<size_t> chunks;
+		for (size_t i = 0; i < chunk_versions.size(); i++) {
+			if (chunk_versions[i] > since) {
+				chunks.push_back(i);
+			}
+		}
+		return chunks;
+	}
+
+	// The world as of the call, e.g. to save a backup with file::world::save
+	// on a thread of its own. Rather than stopping changes for a copy of
+	// the whole world, it copies a chunk at a time, and changes to a chunk
+	// it didn't get to yet copy that chunk first. One snapshot at a time,
+	// further calls wait.
+	file::tiles snapshot(uint64_t* version = nullptr)
+	{
+		std::lock_guard one(snapshotting);
+		profile::scope p("world_mirror.snapshot");
+
+		// allocated and zeroed before locking
+		auto c = std::make_unique<capture>(file::tiles(grid.width(), grid.height()), std::vector<bool>(chunk_versions.size()));
+		{
+			std::unique_lock l(lock);
+			capturing = std::move(c);
+			if (version) {
+				*version = latest;
+			}
+		}
+
+		for (size_t i = 0; i < chunk_versions.size(); i++) {
+			std::unique_lock l(lock);
+			copy_chunk(i);
+		}
+
+		std::unique_lock l(lock);
+		return std::move(std::exchange(capturing, nullptr)->grid);
+	}
+
+	int32_t chunk_rows() const { return chunks_y; }
+	int32_t chunk_columns() const { return chunks_x; }
+
+	// Applies a send_tile_data payload. False if it's malformed or out of
+	// bounds, the mirror is left as it was then.
+	bool apply_section(std::span<const uint8_t> payload)
+	{
+		auto raw = packet::decompress_payload(payload);
+		if (!raw) {
+			return false;
+		}
+
+		auto rd = io::serialized_io(io::buffered_io { *raw });
+		int32_t x, y;
+		int16_t width, height;
+		rd.read(x);
+		rd.read(y);
+		rd.read(width);
+		rd.read(height);
+		if (rd.device().truncated() || width < 0 || height < 0 || !grid.contains(x, y) || !grid.contains(x + width - 1, y + height - 1)) {
+			return false;
+		}
+
+		// rows, unlike the column order of .wld files
+		file::tiles section(width, height);
+		file::tile t;
+		uint16_t repeat = 0;
+		for (int32_t j = 0; j < height; j++) {
+			for (int32_t i = 0; i < width; i++) {
+				if (repeat > 0) {
+					repeat--;
+				} else {
+					repeat = file::read_tile(rd, t, importance);
+				}
+				section.at(i, j) = t;
+			}
+		}
+		if (rd.device().truncated()) {
+			return false;
+		}
+
+		std::unique_lock l(lock);
+		preserve(x, y, width, height);
+		for (int32_t i = 0; i < width; i++) {
+			for (int32_t j = 0; j < height; j++) {
+				grid.at(x + i, y + j) = section.at(i, j);
+			}
+		}
+		touch(x, y, width, height);
+		return true;
+	}
+
+	// Applies a tile square (packet 20) payload.
+	bool apply_square(std::span<uint8_t> payload)
+	{
+		auto rd = io::serialized_io(io::buffered_io { payload });
+		int16_t x, y;
+		uint8_t width, height, change_type;
+		rd.read(x);
+		rd.read(y);
+		rd.read(width);
+		rd.read(height);
+		rd.read(change_type);
+		if (rd.device().truncated() || !grid.contains(x, y) || !grid.contains(x + width - 1, y + height - 1)) {
+			return false;
+		}
+
+		std::unique_lock l(lock);
+		preserve(x, y, width, height);
+		auto before = grid.region(x, y, width, height);
+		for (int32_t i = 0; i < width; i++) {
+			for (int32_t j = 0; j < height; j++) {
+				read_square_tile(rd, grid.at(x + i, y + j));
+			}
+		}
+		if (rd.device().truncated()) {
+			for (int32_t i = 0; i < width; i++) {
+				for (int32_t j = 0; j < height; j++) {
+					grid.at(x + i, y + j) = before.at(i, j);
+				}
+			}
+			return false;
+		}
+		touch(x, y, width, height);
+		return true;
+	}
+
+	// Best effort: only the edits that don't need the game's rules to work
+	// out. The tile squares the server sends after them fill in the rest
+	// (frames, pounding, rejected edits).
+	void apply(const packet::tile_manipulation& m)
+	{
+		using file::tile;
+		using packet::tile_manipulation;
+
+		std::unique_lock l(lock);
+		if (!grid.contains(m.x, m.y)) {
+			return;
+		}
+		preserve(m.x, m.y, 1, 1);
+		auto& t = grid.at(m.x, m.y);
+		auto was = t;
+
+		switch (m.action) {
+		case tile_manipulation::kill_tile:
+		case tile_manipulation::kill_tile_no_item:
+		case tile_manipulation::try_kill_tile:
+			if (m.value == 0) {
+				t.type = 0;
+				t.frame_x = t.frame_y = -1;
+				t.color = 0;
+				t.slope = 0;
+				t.set(tile::active, false);
+				t.set(tile::half_brick, false);
+				t.set(tile::inactive, false);
+			}
+			break;
+		case tile_manipulation::place_tile:
+		case tile_manipulation::replace_tile:
+			t.type = m.value;
+			t.frame_x = t.frame_y = -1;
+			t.set(tile::active, true);
+			break;
+		case tile_manipulation::kill_wall:
+			if (m.value == 0) {
+				t.wall = 0;
+				t.wall_color = 0;
+			}
+			break;
+		case tile_manipulation::place_wall:
+		case tile_manipulation::replace_wall:
+			t.wall = m.value;
+			break;
+		case tile_manipulation::place_wire:
+		case tile_manipulation::kill_wire:
+			t.set(tile::wire, m.action == tile_manipulation::place_wire);
+			break;
+		case tile_manipulation::place_wire2:
+		case tile_manipulation::kill_wire2:
+			t.set(tile::wire2, m.action == tile_manipulation::place_wire2);
+			break;
+		case tile_manipulation::place_wire3:
+		case tile_manipulation::kill_wire3:
+			t.set(tile::wire3, m.action == tile_manipulation::place_wire3);
+			break;
+		case tile_manipulation::place_wire4:
+		case tile_manipulation::kill_wire4:
+			t.set(tile::wire4, m.action == tile_manipulation::place_wire4);
+			break;
+		case tile_manipulation::place_actuator:
+		case tile_manipulation::kill_actuator:
+			t.set(tile::actuator, m.action == tile_manipulation::place_actuator);
+			break;
+		case tile_manipulation::slope_tile:
+			t.slope = m.value;
+			t.set(tile::half_brick, false);
+			break;
+		default:
+			break;
+		}
+
+		if (!(t == was)) {
+			touch(m.x, m.y, 1, 1);
+		}
+	}
+
+	// Keeps the mirror up to date from what `c` receives; a backend
+	// connection gets sections, tile squares and edits, a client one only
+	// its own edits. Register it before handlers that consume packets.
+	//
+	// A server sends every player near an edit the same squares and edits,
+	// so with several connections to it only the one `feeds()` holds for
+	// should apply them; applied again from a connection that's behind they
+	// would undo newer ones. Sections go only to whoever asked, from any.
+	template <class I, class F>
+	void observe(basic_conn<I>& c, bool from_server, F feeds)
+	{
+		if (from_server) {
+			c.reg_handler(send_section_id, [this](std::span<uint8_t> payload) {
+				apply_section(payload);
+				return false;
+			});
+			c.reg_handler(tile_square_id, [this, feeds](std::span<uint8_t> payload) {
+				if (feeds()) {
+					apply_square(payload);
+				}
+				return false;
+			});
+		}
+		c.template reg_handler<packet::tile_manipulation>([this, feeds](packet::tile_manipulation& m) {
+			if (feeds()) {
+				apply(m);
+			}
+			return false;
+		});
+	}
+
+	template <class I>
+	void observe(basic_conn<I>& c, bool from_server)
+	{
+		observe(c, from_server, [] { return true; });
+	}
+};
+
+}
\ No newline at end of file
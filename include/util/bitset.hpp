@@ -84,7 +84,7 @@ public:
 	constexpr bool operator[](T idx) const
 	{
 		unsigned int i = (unsigned int)(idx);
-		assert(i < container_type::size());
+		assert(i / 8 < container_type::size());
 		return (container_type::at(i / 8) & (1 << (i % 8))) > 0;
 	}
 
@@ -92,7 +92,7 @@ public:
 	bit_ref operator[](T idx)
 	{
 		unsigned int i = (unsigned int)(idx);
-		assert(i < container_type::size());
+		assert(i / 8 < container_type::size());
 		return bit_ref(*this, i / 8, (1 << (i % 8)));
 	}
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <bit>
 #include <concepts>
+#include <span>
 
 template <std::integral T>
     requires(sizeof(T) <= 8)
@@ -18,4 +19,19 @@ T to_little(T x)
 	case 8:
 		return __builtin_bswap64(x);
 	}
+}
+
+// Converts a whole range in place. A no-op on little endian hosts; elsewhere
+// a plain loop over one element size, which the compiler turns into vector
+// byte shuffles.
+template <std::integral T>
+    requires(sizeof(T) <= 8)
+void to_little(std::span<T> xs)
+{
+	if constexpr (std::endian::native == std::endian::little || sizeof(T) == 1) {
+		return;
+	}
+	for (auto& x : xs) {
+		x = to_little(x);
+	}
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "util/endian.hpp"
+#include "util/profile.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <boost/pfr/core.hpp>
 #include <cassert>
 #include <concepts>
@@ -9,15 +13,20 @@
 #include <cstdio>
 #include <cstring>
 #include <fcntl.h>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unistd.h>
+#include <vector>
 
 namespace io {
 
 template <class T, class K>
-concept custom_write = requires(T t) {
-	{ t.write(K()) } -> std::same_as<ssize_t>;
+concept custom_write = requires(T& t, K& k) {
+	{ t.write(k) } -> std::same_as<ssize_t>;
 };
 template <class T, class K>
 concept custom_read = requires(T& t, K& k) {
@@ -55,8 +64,32 @@ public:
 	//	::close(fd);
 	//}
 
+	int native_handle() const { return fd; }
+
+	void close() { ::close(fd); }
+
+	void set_nonblocking()
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	// Non-blocking counterparts of read_data/write_data:
+	// return -1 with errno set (EAGAIN included) instead of throwing.
+	ssize_t read_some(char* buf, size_t nbytes)
+	{
+		profile::scope p("file_io.read");
+		return ::read(fd, buf, nbytes);
+	}
+
+	ssize_t write_some(const char* buf, size_t nbytes)
+	{
+		profile::scope p("file_io.write");
+		return ::write(fd, buf, nbytes);
+	}
+
 	ssize_t read_data(char* buf, size_t nbytes)
 	{
+		profile::scope p("file_io.read");
 		auto bytes = ::read(fd, buf, nbytes);
 		if (bytes == EOF) {
 			throw eof{};
@@ -68,6 +101,7 @@ public:
 
 	ssize_t write_data(const char* buf, size_t nbytes)
 	{
+		profile::scope p("file_io.write");
 		auto bytes = ::write(fd, buf, nbytes);		
 		if (bytes == EOF) {
 			throw eof{};
@@ -81,6 +115,7 @@ public:
 template <container T>
 class buffered_io {
 	size_t cursor = 0;
+	bool short_read = false;
 	T& buffer;
 
 public:
@@ -89,9 +124,28 @@ public:
 	{
 	}
 
+	// True once a read ran past the end of the buffer.
+	bool truncated() const { return short_read; }
+
+	// What's left to read, for readers that decode in place.
+	std::span<const uint8_t> remaining() const
+	{
+		return { reinterpret_cast<const uint8_t*>(buffer.data()) + cursor, buffer.size() - cursor };
+	}
+
+	// Skips `nbytes` of remaining(), skipping past the end counts as a
+	// short read.
+	void consume(size_t nbytes)
+	{
+		auto left = buffer.size() - cursor;
+		short_read |= nbytes > left;
+		cursor += std::min(nbytes, left);
+	}
+
 	ssize_t read_data(char* buf, size_t nbytes)
 	{
 		auto bytes = nbytes > (buffer.size() - cursor) ? (buffer.size() - cursor) : nbytes;
+		short_read |= bytes < nbytes;
 
 		memcpy(buf, buffer.data() + cursor, bytes);
 		cursor += bytes;
@@ -105,6 +159,78 @@ public:
 	}
 };
 
+// Reads memory the caller already bounds checked, so a fixed size packet
+// costs one check per frame instead of one per field.
+class unchecked_io {
+	const uint8_t* cursor;
+
+public:
+	unchecked_io(const uint8_t* data)
+	    : cursor(data)
+	{
+	}
+
+	ssize_t read_data(char* buf, size_t nbytes)
+	{
+		memcpy(buf, cursor, nbytes);
+		cursor += nbytes;
+		return nbytes;
+	}
+};
+
+// The 7 bit varints .NET's BinaryWriter prefixes strings with: low bits
+// first, the top bit set on every byte but the last.
+constexpr size_t max_varint_size = 5;
+
+// Decodes the varint at the front of `in` into `v`. Returns the bytes it
+// took, 0 if `in` ends first or it's longer than max_varint_size.
+inline size_t decode_varint(std::span<const uint8_t> in, uint32_t& v)
+{
+	// all but the rare string past 127 bytes
+	if (!in.empty() && in[0] < 0x80) [[likely]] {
+		v = in[0];
+		return 1;
+	}
+
+	v = 0;
+	for (size_t i = 0; i < std::min(in.size(), max_varint_size); i++) {
+		v |= uint32_t(in[i] & 0x7f) << (7 * i);
+		if (in[i] < 0x80) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+// Encodes `v` into `out`, which has room for max_varint_size bytes.
+// Returns the bytes it took.
+inline size_t encode_varint(uint32_t v, uint8_t* out)
+{
+	size_t n = 0;
+	for (; v >= 0x80; v >>= 7) {
+		out[n++] = uint8_t(v | 0x80);
+	}
+	out[n++] = uint8_t(v);
+	return n;
+}
+
+// Splits out.size() varint prefixed strings off the front of `in`, as
+// views into it. Returns the bytes they took, nullopt if `in` ends first.
+inline std::optional<size_t> split_strings(std::span<const uint8_t> in, std::span<std::string_view> out)
+{
+	size_t offset = 0;
+	for (auto& s : out) {
+		uint32_t size;
+		auto n = decode_varint(in.subspan(offset), size);
+		if (n == 0 || in.size() - offset - n < size) {
+			return std::nullopt;
+		}
+		s = { reinterpret_cast<const char*>(in.data() + offset + n), size };
+		offset += n + size;
+	}
+	return offset;
+}
+
 template <class I>
 class serialized_io {
 	I io;
@@ -115,6 +241,9 @@ public:
 	{
 	}
 
+	I& device() { return io; }
+	const I& device() const { return io; }
+
 	template <std::integral T>
 	ssize_t read(T& f)
 	{
@@ -131,15 +260,85 @@ public:
 		return bytes;
 	}
 
+	ssize_t read_varint(uint32_t& v)
+	{
+		if constexpr (requires { io.remaining(); }) {
+			auto in = io.remaining();
+			auto n = decode_varint(in, v);
+			io.consume(n > 0 ? n : in.size() + 1);
+			return n;
+		} else {
+			uint8_t b = 0;
+			auto bytes = read(b);
+			v = b & 0x7f;
+			for (int shift = 7; b >= 0x80 && shift < 7 * int(max_varint_size); shift += 7) {
+				bytes += read(b);
+				v |= uint32_t(b & 0x7f) << shift;
+			}
+			return bytes;
+		}
+	}
+
 	ssize_t read(std::string& f)
 	{
-		// FIXME: varint
-		uint8_t size;
-		auto bytes = read(size);
+		if constexpr (requires { io.remaining(); }) {
+			// in memory: one bounds check and one copy
+			std::string_view s;
+			auto bytes = read_views(std::span(&s, 1));
+			f.assign(s);
+			return bytes;
+		} else {
+			uint32_t size;
+			auto bytes = read_varint(size);
+
+			f.resize(size);
+			bytes += io.read_data(f.data(), size);
+			return bytes;
+		}
+	}
 
-		f.resize(size);
-		bytes += io.read_data(f.data(), size);
-		return bytes;
+	// Reads out.size() strings as views into the buffer, valid as long as it
+	// is: they're all bounds checked before any is handed out, and a short
+	// buffer leaves them empty.
+	ssize_t read_views(std::span<std::string_view> out)
+		requires requires { io.remaining(); }
+	{
+		auto in = io.remaining();
+		auto bytes = split_strings(in, out);
+		if (!bytes) {
+			std::ranges::fill(out, std::string_view {});
+			io.consume(in.size() + 1);
+			return in.size();
+		}
+		io.consume(*bytes);
+		return *bytes;
+	}
+
+	// Reads f.size() strings, in memory in one pass over the lengths before
+	// the copies.
+	ssize_t read(std::vector<std::string>& f)
+	{
+		if constexpr (requires { io.remaining(); }) {
+			std::array<std::string_view, 16> few;
+			std::vector<std::string_view> many;
+			auto views = std::span(few).first(std::min(f.size(), few.size()));
+			if (f.size() > few.size()) {
+				many.resize(f.size());
+				views = many;
+			}
+
+			auto bytes = read_views(views);
+			for (size_t i = 0; i < f.size(); i++) {
+				f[i].assign(views[i]);
+			}
+			return bytes;
+		} else {
+			ssize_t bytes = 0;
+			for (auto& s : f) {
+				bytes += read(s);
+			}
+			return bytes;
+		}
 	}
 
 	template <custom_read<serialized_io<I>> T>
@@ -151,12 +350,27 @@ public:
 	template <container T>
 	ssize_t read(T& f)
 	{
-		return io.read_data(reinterpret_cast<char*>(f.data()), f.size() * sizeof(typename T::value_type));
+		using V = typename T::value_type;
+
+		if constexpr (std::is_arithmetic_v<V>) {
+			auto bytes = io.read_data(reinterpret_cast<char*>(f.data()), f.size() * sizeof(V));
+			if constexpr (std::integral<V>) {
+				to_little(std::span(f.data(), f.size()));
+			}
+			return bytes;
+		} else {
+			ssize_t bytes = 0;
+			for (auto& v : f) {
+				bytes += read(v);
+			}
+			return bytes;
+		}
 	}
 
 	template <class T>
 	ssize_t read(T& f)
 	{
+		profile::scope p("serialized_io.read");
 		ssize_t bytes = 0;
 		boost::pfr::for_each_field(f, [this, &bytes](auto& field) {
 			bytes += read(field);
@@ -178,22 +392,41 @@ public:
 		return io.write_data(reinterpret_cast<const char*>(&f), sizeof(T));
 	}
 
-	ssize_t write(const std::string f)
+	ssize_t write_varint(uint32_t v)
 	{
-		// FIXME: varint
-		auto bytes = write(uint8_t(f.size()));
-		bytes += io.write_data(f.c_str(), f.size());
+		uint8_t buf[max_varint_size];
+		return io.write_data(reinterpret_cast<const char*>(buf), encode_varint(v, buf));
+	}
+
+	ssize_t write(const std::string& f)
+	{
+		auto bytes = write_varint(f.size());
+		bytes += io.write_data(f.data(), f.size());
 		return bytes;
 	}
 
 	template <container T>
 	ssize_t write(const T f)
 	{
-		return io.write_data(reinterpret_cast<const char*>(f.data()), f.size() * sizeof(typename T::value_type));
+		using V = typename T::value_type;
+
+		if constexpr (std::is_arithmetic_v<V> && (std::endian::native == std::endian::little || sizeof(V) == 1 || !std::integral<V>)) {
+			return io.write_data(reinterpret_cast<const char*>(f.data()), f.size() * sizeof(V));
+		} else if constexpr (std::integral<V>) {
+			std::vector<V> swapped(f.begin(), f.end());
+			to_little(std::span(swapped));
+			return io.write_data(reinterpret_cast<const char*>(swapped.data()), swapped.size() * sizeof(V));
+		} else {
+			ssize_t bytes = 0;
+			for (auto& v : f) {
+				bytes += write(v);
+			}
+			return bytes;
+		}
 	}
 
 	template <custom_write<serialized_io<I>> T>
-	ssize_t write(T& f)
+	ssize_t write(T f)
 	{
 		return f.write(*this);
 	}
@@ -201,6 +434,7 @@ public:
 	template <class T>
 	ssize_t write(const T f)
 	{
+		profile::scope p("serialized_io.write");
 		ssize_t bytes = 0;
 		boost::pfr::for_each_field(f, [this, &bytes](auto field) {
 			bytes += write(field);
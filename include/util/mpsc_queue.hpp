@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov).
+// push is wait-free and may be called from any thread, pop only from the owner.
+template <class T>
+class mpsc_queue {
+	struct node {
+		std::atomic<node*> next { nullptr };
+		std::optional<T> value;
+	};
+
+	std::atomic<node*> head;
+	node* tail;
+
+public:
+	mpsc_queue()
+	{
+		auto stub = new node;
+		head.store(stub, std::memory_order_relaxed);
+		tail = stub;
+	}
+
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+	~mpsc_queue()
+	{
+		while (tail != nullptr) {
+			auto next = tail->next.load(std::memory_order_relaxed);
+			delete tail;
+			tail = next;
+		}
+	}
+
+	void push(T value)
+	{
+		auto n = new node;
+		n->value.emplace(std::move(value));
+
+		auto prev = head.exchange(n, std::memory_order_acq_rel);
+		prev->next.store(n, std::memory_order_release);
+	}
+
+	std::optional<T> pop()
+	{
+		auto next = tail->next.load(std::memory_order_acquire);
+		if (next == nullptr) {
+			return std::nullopt;
+		}
+
+		std::optional<T> value = std::move(next->value);
+		next->value.reset();
+		delete tail;
+		tail = next;
+		return value;
+	}
+};
\ No newline at end of file
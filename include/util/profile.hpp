@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Opt-in timing and allocation counts by code path, for finding where a
+// slow process spends its time. Code marks what it does with scopes:
+//
+//	profile::scope p("zlib.deflate");
+//
+// and profile::write_folded() exports the totals as folded stacks
+// ("a;b;c value" lines) for flamegraph.pl and the like.
+//
+// Off until enable(). Then one outermost scope in `every` is sampled,
+// with everything nested in it; the others only bump a thread local
+// counter, so a low rate can stay on in production. Each thread sums up
+// its own samples, writers only meet the exporter's lock while sampled.
+// Allocations count only if the program routes operator new through
+// profile::allocated().
+namespace profile {
+
+enum class metric {
+	// self time, in microseconds
+	time,
+	allocations,
+	bytes,
+};
+
+namespace detail {
+
+struct node {
+	const char* name;
+	uint32_t parent;
+	// including nested scopes
+	uint64_t ns = 0;
+	uint64_t calls = 0;
+	// made by this scope itself
+	uint64_t allocations = 0;
+	uint64_t bytes = 0;
+};
+
+struct totals {
+	uint64_t us = 0;
+	uint64_t allocations = 0;
+	uint64_t bytes = 0;
+};
+
+struct thread_data;
+
+// this thread's data while one of its scopes is sampled, for allocated()
+inline thread_local thread_data* sampling = nullptr;
+
+struct registry {
+	std::mutex lock;
+	std::vector<thread_data*> live;
+	// of threads that exited, by stack
+	std::map<std::string, totals> retired;
+};
+
+inline registry& threads()
+{
+	static registry r;
+	return r;
+}
+
+// sample one outermost scope in this many, 0 when off
+inline std::atomic<uint32_t> every = 0;
+
+struct thread_data {
+	// taken by the owner while sampled and by the exporter
+	std::mutex lock;
+	std::vector<node> nodes { { "", 0 } };
+	std::map<std::pair<uint32_t, const char*>, uint32_t> children;
+
+	uint32_t current = 0;
+	uint32_t depth = 0;
+	uint32_t ticks = 0;
+	// the profiler itself allocating
+	bool busy = false;
+
+	thread_data()
+	{
+		std::lock_guard l(threads().lock);
+		threads().live.push_back(this);
+	}
+
+	~thread_data();
+
+	uint32_t child(uint32_t parent, const char* name)
+	{
+		auto [it, inserted] = children.try_emplace({ parent, name }, nodes.size());
+		if (inserted) {
+			nodes.push_back({ name, parent });
+		}
+		return it->second;
+	}
+
+	// Adds this thread's samples to `out`, by stack. Caller holds `lock`.
+	void fold(std::map<std::string, totals>& out) const
+	{
+		std::vector<std::string> paths(nodes.size());
+		std::vector<uint64_t> nested(nodes.size());
+		for (size_t i = 1; i < nodes.size(); i++) {
+			auto& n = nodes[i];
+			// parents come first
+			paths[i] = n.parent == 0 ? n.name : paths[n.parent] + ";" + n.name;
+			nested[n.parent] += n.ns;
+		}
+		for (size_t i = 1; i < nodes.size(); i++) {
+			auto& t = out[paths[i]];
+			t.us += (nodes[i].ns - std::min(nested[i], nodes[i].ns)) / 1000;
+			t.allocations += nodes[i].allocations;
+			t.bytes += nodes[i].bytes;
+		}
+	}
+};
+
+inline thread_data::~thread_data()
+{
+	sampling = nullptr;
+	auto& r = threads();
+	std::scoped_lock l(r.lock, lock);
+	std::erase(r.live, this);
+	fold(r.retired);
+}
+
+inline thread_data& local()
+{
+	thread_local thread_data d;
+	return d;
+}
+
+}
+
+// Starts sampling one outermost scope in `n`, e.g. 1 to see everything.
+inline void enable(uint32_t n = 1000) { detail::every.store(n, std::memory_order_relaxed); }
+
+inline void disable() { detail::every.store(0, std::memory_order_relaxed); }
+
+// To be called by a replaced operator new.
+inline void allocated(size_t size)
+{
+	auto d = detail::sampling;
+	if (d == nullptr || d->busy) {
+		return;
+	}
+	d->busy = true;
+	{
+		std::lock_guard l(d->lock);
+		d->nodes[d->current].allocations++;
+		d->nodes[d->current].bytes += size;
+	}
+	d->busy = false;
+}
+
+// Times what runs until it goes out of scope. `name` has to outlive the
+// program, a string literal usually; scopes nested in one of the same
+// name fold into it, so recursive code doesn't blow up the stacks. Don't
+// keep one across a co_await, other scopes run meanwhile.
+class scope {
+	detail::thread_data* d = nullptr;
+	uint32_t node = 0;
+	uint32_t parent = 0;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit scope(const char* name)
+	{
+		auto n = detail::every.load(std::memory_order_relaxed);
+		if (n == 0) {
+			return;
+		}
+		d = &detail::local();
+		d->depth++;
+		if (d->depth == 1 && ++d->ticks % n == 0) {
+			detail::sampling = d;
+		}
+		if (detail::sampling != d || d->nodes[d->current].name == name) {
+			return;
+		}
+
+		d->busy = true;
+		{
+			std::lock_guard l(d->lock);
+			parent = d->current;
+			node = d->child(parent, name);
+			d->current = node;
+		}
+		d->busy = false;
+		start = std::chrono::steady_clock::now();
+	}
+
+	scope(const scope&) = delete;
+
+	~scope()
+	{
+		if (d == nullptr) {
+			return;
+		}
+		if (node != 0) {
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			std::lock_guard l(d->lock);
+			d->nodes[node].ns += ns;
+			d->nodes[node].calls++;
+			d->current = parent;
+		}
+		if (--d->depth == 0) {
+			detail::sampling = nullptr;
+		}
+	}
+};
+
+// Writes every thread's samples so far as folded stacks, one per line.
+inline void write_folded(std::FILE* out, metric m = metric::time)
+{
+	// folding allocates, and this thread's lock is taken below
+	auto was = std::exchange(detail::sampling, nullptr);
+	std::map<std::string, detail::totals> all;
+	{
+		auto& r = detail::threads();
+		std::lock_guard l(r.lock);
+		all = r.retired;
+		for (auto t : r.live) {
+			std::lock_guard tl(t->lock);
+			t->fold(all);
+		}
+	}
+	detail::sampling = was;
+
+	for (auto& [stack, t] : all) {
+		auto v = m == metric::time ? t.us : m == metric::allocations ? t.allocations : t.bytes;
+		if (v > 0) {
+			std::fprintf(out, "%s %llu\n", stack.c_str(), (unsigned long long)v);
+		}
+	}
+}
+
+}
\ No newline at end of file
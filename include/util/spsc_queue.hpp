@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// Bounded lock-free single-producer/single-consumer ring.
+// Slots carry a sequence number (Vyukov), so besides the consumer the
+// producer may also pop, which is how it evicts the oldest element when full.
+template <class T>
+class spsc_queue {
+	struct slot {
+		std::atomic<size_t> seq;
+		T value;
+	};
+
+	std::unique_ptr<slot[]> slots;
+	size_t mask;
+
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+
+public:
+	// `capacity` has to be a power of two
+	explicit spsc_queue(size_t capacity)
+	    : slots(new slot[capacity])
+	    , mask(capacity - 1)
+	{
+		assert(capacity > 0 && (capacity & mask) == 0);
+		for (size_t i = 0; i < capacity; i++) {
+			slots[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	size_t capacity() const { return mask + 1; }
+
+	size_t size() const
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	bool empty() const { return size() == 0; }
+
+	// Producer only.
+	bool try_push(T& value)
+	{
+		auto pos = tail.load(std::memory_order_relaxed);
+		auto& s = slots[pos & mask];
+		if (s.seq.load(std::memory_order_acquire) != pos) {
+			return false;
+		}
+
+		s.value = std::move(value);
+		s.seq.store(pos + 1, std::memory_order_release);
+		tail.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer, or the producer evicting the oldest element.
+	std::optional<T> try_pop()
+	{
+		auto pos = head.load(std::memory_order_relaxed);
+		for (;;) {
+			auto& s = slots[pos & mask];
+			auto diff = intptr_t(s.seq.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+
+			if (diff < 0) {
+				return std::nullopt;
+			}
+			if (diff > 0) {
+				pos = head.load(std::memory_order_relaxed);
+				continue;
+			}
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				std::optional<T> value = std::move(s.value);
+				s.seq.store(pos + mask + 1, std::memory_order_release);
+				return value;
+			}
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,829 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util/io.hpp"
+
+namespace io {
+
+// Minimal io_uring wrapper built on the raw syscalls (no liburing).
+// A ring is not thread safe: use one ring per thread.
+class uring {
+public:
+	using completion = std::function<void(const io_uring_cqe&)>;
+
+	static constexpr uint16_t buffer_group = 0;
+	static constexpr uint32_t buffer_size = 4096;
+	static constexpr uint16_t buffer_count = 1024;
+
+private:
+	int ring_fd = -1;
+	unsigned entries = 0;
+
+	void* sq_ptr = MAP_FAILED;
+	size_t sq_len = 0;
+	void* cq_ptr = MAP_FAILED;
+	size_t cq_len = 0;
+	io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	size_t sqes_len = 0;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	unsigned* sq_flags;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	io_uring_cqe* cqes;
+
+	unsigned sqe_tail = 0;
+	unsigned submitted = 0;
+
+	// user_data of every sqe is an index into this table
+	std::deque<completion> completions;
+	std::vector<uint64_t> free_completions;
+
+	// provided buffer ring shared by every receive on this ring.
+	// Indexed as plain io_uring_buf: in C++ the empty struct inside
+	// __DECLARE_FLEX_ARRAY shifts io_uring_buf_ring::bufs by 8 bytes.
+	io_uring_buf* br = static_cast<io_uring_buf*>(MAP_FAILED);
+	size_t br_len = 0;
+	std::vector<char> buffer_pool;
+
+	static int sys_setup(unsigned entries, io_uring_params* p)
+	{
+		return syscall(__NR_io_uring_setup, entries, p);
+	}
+
+	static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+	{
+		return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+	}
+
+	static int sys_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+	{
+		return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+	}
+
+	void setup_buffers()
+	{
+		br_len = buffer_count * sizeof(io_uring_buf);
+		br = static_cast<io_uring_buf*>(mmap(nullptr, br_len, PROT_READ | PROT_WRITE,
+		    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+		if (br == MAP_FAILED)
+			throw std::runtime_error(strerror(errno));
+
+		io_uring_buf_reg reg {};
+		reg.ring_addr = reinterpret_cast<uint64_t>(br);
+		reg.ring_entries = buffer_count;
+		reg.bgid = buffer_group;
+		if (sys_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+			throw std::runtime_error(strerror(errno));
+
+		buffer_pool.resize(size_t(buffer_count) * buffer_size);
+		for (uint16_t bid = 0; bid < buffer_count; bid++) {
+			recycle_buffer(bid);
+		}
+	}
+
+	bool probe_ops()
+	{
+		std::vector<char> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+		auto p = reinterpret_cast<io_uring_probe*>(buf.data());
+		if (sys_register(ring_fd, IORING_REGISTER_PROBE, p, 256) < 0)
+			return false;
+
+		for (unsigned op : { IORING_OP_NOP, IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_ASYNC_CANCEL }) {
+			if (op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED))
+				return false;
+		}
+		return true;
+	}
+
+	// Multishot came after IORING_OP_RECV itself (linux 6.0), the probe
+	// doesn't tell: an older kernel fails the sqe with EINVAL instead.
+	bool probe_multishot_recv()
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+			return false;
+
+		bool more = false, received = false, finished = false;
+		auto id = prep_recv_multishot(sv[0], [&](const io_uring_cqe& cqe) {
+			if (!received) {
+				received = true;
+				more = cqe.res > 0 && (cqe.flags & IORING_CQE_F_MORE);
+			}
+			finished = !(cqe.flags & IORING_CQE_F_MORE);
+			if (cqe.flags & IORING_CQE_F_BUFFER)
+				recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		});
+		submit();
+		[[maybe_unused]] auto _ = ::write(sv[1], "x", 1);
+		while (!received) {
+			run(1);
+		}
+		if (!finished) {
+			prep_cancel(id);
+		}
+		while (!finished) {
+			run(1);
+		}
+
+		::close(sv[0]);
+		::close(sv[1]);
+		return more;
+	}
+
+	void release()
+	{
+		if (br != MAP_FAILED)
+			munmap(br, br_len);
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqes_len);
+		if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+			munmap(cq_ptr, cq_len);
+		if (sq_ptr != MAP_FAILED)
+			munmap(sq_ptr, sq_len);
+		if (ring_fd >= 0)
+			close(ring_fd);
+	}
+
+public:
+	uring(unsigned entries = 256)
+	{
+		io_uring_params p {};
+		ring_fd = sys_setup(entries, &p);
+		if (ring_fd < 0)
+			throw std::runtime_error(strerror(errno));
+
+		try {
+			sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+			if (p.features & IORING_FEAT_SINGLE_MMAP) {
+				sq_len = cq_len = std::max(sq_len, cq_len);
+			}
+
+			sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			    ring_fd, IORING_OFF_SQ_RING);
+			if (sq_ptr == MAP_FAILED)
+				throw std::runtime_error(strerror(errno));
+
+			if (p.features & IORING_FEAT_SINGLE_MMAP) {
+				cq_ptr = sq_ptr;
+			} else {
+				cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				    ring_fd, IORING_OFF_CQ_RING);
+				if (cq_ptr == MAP_FAILED)
+					throw std::runtime_error(strerror(errno));
+			}
+
+			sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+			sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+			if (sqes == MAP_FAILED)
+				throw std::runtime_error(strerror(errno));
+
+			auto sq = static_cast<char*>(sq_ptr);
+			sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+			sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+			sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+			sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+			sq_flags = reinterpret_cast<unsigned*>(sq + p.sq_off.flags);
+
+			auto cq = static_cast<char*>(cq_ptr);
+			cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+			cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+			cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+			this->entries = p.sq_entries;
+			sqe_tail = submitted = *sq_tail;
+
+			setup_buffers();
+		} catch (...) {
+			release();
+			throw;
+		}
+	}
+
+	uring(const uring&) = delete;
+	uring& operator=(const uring&) = delete;
+
+	~uring()
+	{
+		release();
+	}
+
+	// Checks that the running kernel has everything this wrapper relies on:
+	// the opcodes (IORING_REGISTER_PROBE), provided buffer rings (a ring
+	// registers one when it's set up) and multishot recv, tried for real.
+	static bool supported()
+	{
+		static const bool ok = [] {
+			try {
+				uring probe(4);
+				return probe.probe_ops() && probe.probe_multishot_recv();
+			} catch (std::runtime_error&) {
+				return false;
+			}
+		}();
+		return ok;
+	}
+
+	// Readable while completions wait to be reap()ed, for an event loop.
+	int native_handle() const { return ring_fd; }
+
+	io_uring_sqe* get_sqe(completion c = {})
+	{
+		if (sqe_tail - std::atomic_ref(*sq_head).load(std::memory_order_acquire) >= entries) {
+			submit();
+			while (sqe_tail - std::atomic_ref(*sq_head).load(std::memory_order_acquire) >= entries) {
+				run(1);
+			}
+		}
+
+		auto idx = sqe_tail & *sq_mask;
+		auto sqe = &sqes[idx];
+		std::memset(sqe, 0, sizeof(*sqe));
+		sq_array[idx] = idx;
+		sqe_tail++;
+
+		uint64_t id;
+		if (free_completions.empty()) {
+			id = completions.size();
+			completions.emplace_back(std::move(c));
+		} else {
+			id = free_completions.back();
+			free_completions.pop_back();
+			completions[id] = std::move(c);
+		}
+		sqe->user_data = id;
+		return sqe;
+	}
+
+	int submit(unsigned wait_nr = 0)
+	{
+		std::atomic_ref(*sq_tail).store(sqe_tail, std::memory_order_release);
+		auto to_submit = sqe_tail - submitted;
+		submitted = sqe_tail;
+
+		int ret;
+		do {
+			ret = sys_enter(ring_fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret < 0 && errno != EBUSY && errno != EAGAIN)
+			throw std::runtime_error(strerror(errno));
+		return ret;
+	}
+
+	// Dispatches every available completion, returns how many were handled.
+	unsigned reap()
+	{
+		unsigned count = 0;
+
+		for (;;) {
+			// callbacks may reap too
+			unsigned head = *cq_head;
+			if (head == std::atomic_ref(*cq_tail).load(std::memory_order_acquire)) {
+				// completions past a full cq wait in the kernel until asked for
+				if (!(std::atomic_ref(*sq_flags).load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW))
+					break;
+				sys_enter(ring_fd, 0, 0, IORING_ENTER_GETEVENTS);
+				if (head == std::atomic_ref(*cq_tail).load(std::memory_order_acquire))
+					break;
+			}
+			auto cqe = cqes[head & *cq_mask];
+			head++;
+			std::atomic_ref(*cq_head).store(head, std::memory_order_release);
+			count++;
+
+			auto id = cqe.user_data;
+			if (id >= completions.size()) {
+				continue;
+			}
+
+			auto more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+			if (more) {
+				if (completions[id])
+					completions[id](cqe);
+			} else {
+				auto c = std::move(completions[id]);
+				completions[id] = nullptr;
+				free_completions.push_back(id);
+				if (c)
+					c(cqe);
+			}
+		}
+		return count;
+	}
+
+	// Submits pending sqes, waits for at least `wait_nr` completions and dispatches them.
+	unsigned run(unsigned wait_nr = 1)
+	{
+		submit(wait_nr);
+		return reap();
+	}
+
+	std::span<char> buffer(uint16_t bid, size_t len)
+	{
+		return { buffer_pool.data() + size_t(bid) * buffer_size, len };
+	}
+
+	void recycle_buffer(uint16_t bid)
+	{
+		// the ring tail overlays the first buffer's resv field
+		auto tail = br[0].resv;
+		auto& buf = br[tail & (buffer_count - 1)];
+		buf.addr = reinterpret_cast<uint64_t>(buffer_pool.data() + size_t(bid) * buffer_size);
+		buf.len = buffer_size;
+		buf.bid = bid;
+		std::atomic_ref(br[0].resv).store(tail + 1, std::memory_order_release);
+	}
+
+	void prep_accept_multishot(int fd, completion c)
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = fd;
+		sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+	}
+
+	// Returns the sqe's user_data, for prep_cancel().
+	uint64_t prep_recv_multishot(int fd, completion c)
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = fd;
+		sqe->ioprio |= IORING_RECV_MULTISHOT;
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = buffer_group;
+		return sqe->user_data;
+	}
+
+	// Cancels the request `user_data` names, which has to be still pending:
+	// its completion wasn't reap()ed yet.
+	void prep_cancel(uint64_t user_data, completion c = {})
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = user_data;
+	}
+
+	void prep_nop(completion c)
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_NOP;
+		sqe->fd = -1;
+	}
+
+	void prep_read(int fd, char* buf, size_t nbytes, completion c)
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uint64_t>(buf);
+		sqe->len = nbytes;
+		sqe->off = uint64_t(-1);
+	}
+
+	void prep_write(int fd, const char* buf, size_t nbytes, bool link, completion c)
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uint64_t>(buf);
+		sqe->len = nbytes;
+		sqe->off = uint64_t(-1);
+		if (link)
+			sqe->flags |= IOSQE_IO_LINK;
+	}
+
+	void prep_send(int fd, const char* buf, size_t nbytes, bool link, completion c)
+	{
+		auto sqe = get_sqe(std::move(c));
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uint64_t>(buf);
+		sqe->len = nbytes;
+		// a short send would otherwise break the link silently
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		if (link)
+			sqe->flags |= IOSQE_IO_LINK;
+	}
+};
+
+// read_data/write_data backend driven by an io::uring.
+// Sockets receive through a multishot recv into the ring's provided buffers,
+// writes are queued and submitted as one linked chain on flush().
+// Without a ring it behaves like file_io. The ring must outlive its streams.
+//
+// After set_nonblocking() a socket never waits on the ring: read_some and
+// write_some fail with EAGAIN instead, and on_ready() says when to try again.
+// Whoever owns the ring reap()s it, e.g. from an event loop watching
+// uring::native_handle().
+class uring_io {
+	struct stream : std::enable_shared_from_this<stream> {
+		int fd;
+		uring* ring;
+		bool socket;
+
+		bool evented = false;
+		std::function<void()> ready;
+
+		bool armed = false;
+		bool cancelling = false;
+		uint64_t recv_id = 0;
+		bool closed = false;
+		int error = 0;
+
+		struct chunk {
+			uint16_t bid;
+			size_t offset;
+			size_t len;
+		};
+		std::deque<chunk> received;
+
+		std::vector<std::vector<char>> pending;
+		size_t inflight = 0;
+		// bytes written but not sent yet
+		size_t queued = 0;
+
+		stream(int fd, uring* ring, bool socket)
+		    : fd(fd)
+		    , ring(ring)
+		    , socket(socket)
+		{
+		}
+
+		~stream()
+		{
+			for (auto& c : received) {
+				ring->recycle_buffer(c.bid);
+			}
+		}
+
+		void notify()
+		{
+			if (ready) {
+				auto r = ready;
+				r();
+			}
+		}
+
+		void arm()
+		{
+			armed = true;
+			recv_id = ring->prep_recv_multishot(fd, [st = weak_from_this(), ring = ring](const io_uring_cqe& cqe) {
+				auto s = st.lock();
+				if (!s) {
+					// the buffer goes back to the ring all the same
+					if (cqe.flags & IORING_CQE_F_BUFFER) {
+						ring->recycle_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+					}
+					return;
+				}
+				if (!(cqe.flags & IORING_CQE_F_MORE)) {
+					s->armed = false;
+					s->cancelling = false;
+				}
+
+				if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+					uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+					s->received.push_back({ bid, 0, size_t(cqe.res) });
+					// nobody reads it: leave the ring's buffers to the other streams
+					if (s->received.size() >= max_received) {
+						s->cancel();
+					}
+				} else if (cqe.res == 0) {
+					s->closed = true;
+				} else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+					s->error = -cqe.res;
+				}
+				s->notify();
+			});
+			ring->submit();
+		}
+
+		// Stops the multishot recv, which otherwise holds the socket open
+		// and keeps taking its data.
+		void cancel()
+		{
+			if (armed && !cancelling) {
+				cancelling = true;
+				ring->prep_cancel(recv_id);
+				ring->submit();
+			}
+		}
+
+		// Only one chain is in flight at a time, otherwise two chains could
+		// race each other on the socket.
+		void flush()
+		{
+			if (pending.empty() || inflight > 0) {
+				return;
+			}
+
+			auto count = pending.size();
+			inflight = count;
+			for (size_t i = 0; i < count; i++) {
+				auto data = std::make_shared<std::vector<char>>(std::move(pending[i]));
+				auto done = [st = weak_from_this(), data](const io_uring_cqe& cqe) {
+					auto s = st.lock();
+					if (!s) {
+						return;
+					}
+					s->queued -= data->size();
+					if (cqe.res < 0 && cqe.res != -ECANCELED) {
+						s->error = -cqe.res;
+					}
+					if (--s->inflight == 0) {
+						if (s->error == 0) {
+							s->flush();
+						}
+						s->notify();
+					}
+				};
+
+				bool link = i + 1 < count;
+				if (socket) {
+					ring->prep_send(fd, data->data(), data->size(), link, std::move(done));
+				} else {
+					ring->prep_write(fd, data->data(), data->size(), link, std::move(done));
+				}
+			}
+			pending.clear();
+			ring->submit();
+		}
+	};
+
+	static constexpr size_t max_pending = 64;
+	// what a non-blocking socket takes before EAGAIN, about a socket's send buffer
+	static constexpr size_t max_queued = 1 << 20;
+	static constexpr size_t chunk_size = 64 * 1024;
+	static constexpr size_t max_received = 64;
+
+	int fd;
+	std::shared_ptr<stream> s;
+
+	ssize_t read_received(char* buf, size_t nbytes)
+	{
+		size_t bytes = 0;
+		while (bytes < nbytes && !s->received.empty()) {
+			auto& c = s->received.front();
+			auto n = std::min(nbytes - bytes, c.len - c.offset);
+			std::memcpy(buf + bytes, s->ring->buffer(c.bid, c.len).data() + c.offset, n);
+			c.offset += n;
+			bytes += n;
+
+			if (c.offset == c.len) {
+				s->ring->recycle_buffer(c.bid);
+				s->received.pop_front();
+			}
+		}
+		return bytes;
+	}
+
+public:
+	uring_io(int fd, uring* ring = nullptr)
+	    : fd(fd)
+	{
+		if (ring == nullptr) {
+			return;
+		}
+
+		struct stat st;
+		bool socket = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+		s = std::make_shared<stream>(fd, ring, socket);
+	}
+
+	int native_handle() const { return fd; }
+
+	void close()
+	{
+		if (s) {
+			s->ready = nullptr;
+			s->cancel();
+		}
+		::close(fd);
+	}
+
+	void set_nonblocking()
+	{
+		file_io(fd).set_nonblocking();
+		if (s && s->socket) {
+			s->evented = true;
+		}
+	}
+
+	// `cb` runs from reap() whenever a read or write might get further,
+	// until close().
+	void on_ready(std::function<void()> cb)
+	{
+		if (s) {
+			s->ready = std::move(cb);
+		}
+	}
+
+	// Runs the on_ready() callback from the ring, e.g. for data received
+	// while the owner didn't read, with nothing left on the socket to
+	// tell it to.
+	void notify()
+	{
+		if (s && s->evented) {
+			s->ring->prep_nop([st = std::weak_ptr(s)](const io_uring_cqe&) {
+				if (auto s = st.lock()) {
+					s->notify();
+				}
+			});
+			s->ring->submit();
+		}
+	}
+
+	// Stops receiving and waits for the writes queued so far to hit the
+	// socket, so another process can carry on with it. Returns what was
+	// received but not read yet.
+	std::vector<char> settle()
+	{
+		std::vector<char> ahead;
+		if (!s || !s->socket) {
+			return ahead;
+		}
+
+		s->cancel();
+		for (;;) {
+			if (s->error == 0) {
+				s->flush();
+			} else {
+				for (auto& p : s->pending) {
+					s->queued -= p.size();
+				}
+				s->pending.clear();
+			}
+			if (!s->armed && s->inflight == 0) {
+				break;
+			}
+			s->ring->run(1);
+		}
+
+		for (auto& c : s->received) {
+			ahead.insert(ahead.end(), s->ring->buffer(c.bid, c.len).data() + c.offset, s->ring->buffer(c.bid, c.len).data() + c.len);
+			s->ring->recycle_buffer(c.bid);
+		}
+		s->received.clear();
+		return ahead;
+	}
+
+	ssize_t read_data(char* buf, size_t nbytes)
+	{
+		if (!s) {
+			return file_io(fd).read_data(buf, nbytes);
+		}
+
+		flush();
+
+		if (!s->socket) {
+			int res = 0;
+			bool done = false;
+			s->ring->prep_read(fd, buf, nbytes, [&](const io_uring_cqe& cqe) {
+				res = cqe.res;
+				done = true;
+			});
+			while (!done) {
+				s->ring->run(1);
+			}
+			if (res < 0) {
+				throw file_io::eof {};
+			}
+			return res;
+		}
+
+		while (s->received.empty() && !s->closed) {
+			if (s->error != 0) {
+				throw file_io::eof {};
+			}
+			if (!s->armed) {
+				s->arm();
+			}
+			s->ring->run(1);
+		}
+		return read_received(buf, nbytes);
+	}
+
+	// Like read_data, but returns 0 once the peer is gone and -1 with errno
+	// set on errors instead of throwing.
+	ssize_t read_some(char* buf, size_t nbytes)
+	{
+		if (!s) {
+			return file_io(fd).read_some(buf, nbytes);
+		}
+		if (!s->socket) {
+			try {
+				return read_data(buf, nbytes);
+			} catch (file_io::eof) {
+				errno = EIO;
+				return -1;
+			}
+		}
+
+		flush();
+		while (s->received.empty() && !s->closed) {
+			if (s->error != 0) {
+				errno = s->error;
+				return -1;
+			}
+			if (!s->armed) {
+				s->arm();
+			}
+			if (s->evented) {
+				errno = EAGAIN;
+				return -1;
+			}
+			s->ring->run(1);
+		}
+		return read_received(buf, nbytes);
+	}
+
+	ssize_t write_data(const char* buf, size_t nbytes)
+	{
+		if (!s) {
+			return file_io(fd).write_data(buf, nbytes);
+		}
+		if (s->error != 0) {
+			throw file_io::eof {};
+		}
+
+		s->pending.emplace_back(buf, buf + nbytes);
+		s->queued += nbytes;
+		if (s->pending.size() >= max_pending) {
+			while (s->inflight > 0 && s->error == 0) {
+				s->ring->run(1);
+			}
+			flush();
+		}
+		return nbytes;
+	}
+
+	// Like write_data, but returns -1 with errno set instead of throwing.
+	// Writes are only queued; a non-blocking socket takes up to max_queued
+	// bytes like a send buffer would, fails with EAGAIN past that, and
+	// submits right away.
+	ssize_t write_some(const char* buf, size_t nbytes)
+	{
+		if (!s) {
+			return file_io(fd).write_some(buf, nbytes);
+		}
+		if (s->error != 0) {
+			errno = s->error;
+			return -1;
+		}
+		if (!s->evented) {
+			return write_data(buf, nbytes);
+		}
+
+		if (s->queued >= max_queued) {
+			errno = EAGAIN;
+			return -1;
+		}
+		nbytes = std::min(nbytes, max_queued - s->queued);
+		// small writes share a buffer while a chain is in flight
+		if (s->pending.empty() || s->pending.back().size() + nbytes > chunk_size) {
+			s->pending.emplace_back();
+		}
+		s->pending.back().insert(s->pending.back().end(), buf, buf + nbytes);
+		s->queued += nbytes;
+		s->flush();
+		return nbytes;
+	}
+
+	// Submits every queued write as a single linked chain, so they hit the
+	// socket in order and a failed write cancels the rest.
+	void flush()
+	{
+		if (s) {
+			s->flush();
+		}
+	}
+};
+
+}
\ No newline at end of file
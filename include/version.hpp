@@ -1,4 +1,7 @@
 #pragma once
 
 constexpr auto max_buffs = 44;
+constexpr auto max_players = 255;
+constexpr auto max_inventory_slots = 350;
+constexpr auto max_name_length = 20;
 constexpr auto terraria_version = 279;
\ No newline at end of file
@@ -1,52 +1,974 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <span>
+#include <stop_token>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "net/client.hpp"
 #include "net/conn.hpp"
-#include "net/server.hpp"
+#include "net/handoff.hpp"
+#include "net/handshake.hpp"
+#include "net/join_cache.hpp"
+#include "net/packet_stream.hpp"
+#include "net/registry.hpp"
+#include "net/player_table.hpp"
+#include "net/router.hpp"
+#include "net/shard.hpp"
+#include "net/socket_options.hpp"
+#include "net/task.hpp"
 #include "net/types.hpp"
+#include "net/world_mirror.hpp"
+#include "util/profile.hpp"
+#include "util/uring.hpp"
 
-void forward_packets(net::conn& dst, net::conn& src)
+// allocations count towards the sampled scopes once --profile is on
+void* operator new(size_t size)
+{
+	profile::allocated(size);
+	if (auto p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+// out of line, or gcc sees free() on what new returned and warns
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// Sleeps for `d`, or until `stop` is requested; false then.
+bool sleep_for(std::stop_token stop, std::chrono::seconds d)
+{
+	std::mutex m;
+	std::condition_variable_any cv;
+	std::unique_lock lock(m);
+	cv.wait_for(lock, stop, d, [] { return false; });
+	return !stop.stop_requested();
+}
+
+// Rewrites `path` with the time spent so far, and `path`.allocs with the
+// allocations, every few seconds until stopped.
+void dump_profile(std::stop_token stop, std::string path)
+{
+	while (sleep_for(stop, std::chrono::seconds(10))) {
+		for (auto [file, m] : { std::pair { path, profile::metric::time }, { path + ".allocs", profile::metric::allocations } }) {
+			auto tmp = file + ".tmp";
+			auto out = fopen(tmp.c_str(), "w");
+			if (out == nullptr) {
+				continue;
+			}
+			profile::write_folded(out, m);
+			fclose(out);
+			rename(tmp.c_str(), file.c_str());
+		}
+	}
+}
+
+// ids of the packets that lead with a client id, see remap()
+static const auto slot_ids = net::handshake::slot_ids();
+
+// with --uring, sockets are read and written through a ring per shard;
+// without, io::uring_io is plain file_io
+using conn = net::basic_conn<io::uring_io>;
+std::vector<std::unique_ptr<io::uring>> rings;
+
+// The ring of shard `index`, set up on first use on that shard's thread.
+io::uring* ring_of(unsigned index, net::event_loop& loop)
+{
+	if (rings.empty()) {
+		return nullptr;
+	}
+	auto& r = rings[index];
+	if (!r) {
+		r = std::make_unique<io::uring>();
+		loop.add(r->native_handle(), EPOLLIN, [ring = r.get()](uint32_t) { ring->reap(); });
+	}
+	return r.get();
+}
+
+// with --stream, every frame goes out to local tools too: session n's
+// client frames as source 2n, its backend's as 2n+1
+std::unique_ptr<net::packet_stream> stream;
+std::atomic<uint32_t> sessions = 0;
+
+void publish(conn& c, uint32_t source)
+{
+	if (stream) {
+		c.set_stream(*stream, source);
+	}
+}
+
+struct session {
+	conn client;
+	std::unique_ptr<conn> upstream;
+	net::backend* backend;
+
+	// what the client sent to join, replayed to the backend it moves to
+	net::handshake join;
+	// connection to that backend until it accepted the player
+	std::unique_ptr<conn> joining;
+	// from the /move on, connecting included
+	bool moving = false;
+
+	// slot the client knows itself by, and the one its backend gave it; they
+	// differ once it moved
+	uint8_t slot = max_players;
+	uint8_t upstream_slot = max_players;
+
+	// until the client asked for the world, a stalled join (e.g. at the password prompt) gets dropped
+	std::optional<net::event_loop::timer> join_deadline;
+
+	bool closed = false;
+
+	uint32_t id = sessions++;
+	unsigned shard_index = 0;
+};
+
+// every shard's open sessions, touched only on that shard's thread
+std::vector<std::unordered_set<session*>> live;
+
+// every shard's sessions still connecting to their backend, not live yet
+struct connecting_sessions {
+	unsigned count = 0;
+	// set by hand_over, gets each of them once connected (nullptr if that failed)
+	std::function<void(session*)> then;
+};
+std::vector<connecting_sessions> connecting;
+
+net::router backends;
+
+// one per backend, shared by every shard and kept up to date from what each
+// player reports about itself, by the backend's slots
+std::unordered_map<const net::backend*, std::unique_ptr<net::player_table>> players;
+
+net::player_table& players_of(const net::backend* b)
+{
+	return *players.at(b);
+}
+
+// with --world, the tiles of those backends, kept up to date from what passes through
+std::unordered_map<const net::backend*, std::unique_ptr<net::world_mirror>> worlds;
+
+net::world_mirror* world_of(const net::backend* b)
+{
+	auto it = worlds.find(b);
+	return it == worlds.end() ? nullptr : it->second.get();
+}
+
+// the upstream each mirror takes the backend's tile edits from, any
+// connection to it will do
+std::unordered_map<const net::backend*, std::atomic<const conn*>> feeders;
+
+// Whether `c` feeds the mirror of `b`, electing it if nobody does.
+bool feeds(const net::backend* b, const conn& c)
+{
+	auto& f = feeders.at(b);
+	const conn* current = nullptr;
+	return f.compare_exchange_strong(current, &c) || current == &c;
+}
+
+// Lets another upstream feed the mirror of `b` if `c` did.
+void stop_feeding(const net::backend* b, const conn& c)
+{
+	if (auto it = feeders.find(b); it != feeders.end()) {
+		const conn* current = &c;
+		it->second.compare_exchange_strong(current, nullptr);
+	}
+}
+
+// with --snapshot-every, a --world mirror saved next to its file
+struct backup {
+	net::world_mirror* mirror;
+	std::string path;
+	std::string name;
+	int32_t id;
+	file::tile_importance importance;
+	// version of the last one saved
+	uint64_t saved = 0;
+};
+
+// Saves the mirrors that changed every `interval` until stopped. Snapshots
+// hold tile updates up for a chunk copy at most, the saving happens on this
+// thread.
+void save_snapshots(std::stop_token stop, std::vector<backup> backups, std::chrono::seconds interval)
+{
+	while (sleep_for(stop, interval)) {
+		for (auto& b : backups) {
+			if (b.mirror->version() == b.saved) {
+				continue;
+			}
+			uint64_t version;
+			auto tiles = b.mirror->snapshot(&version);
+			auto tmp = b.path + ".tmp";
+			try {
+				file::world::save(tmp, b.name, b.id, tiles, b.importance);
+				rename(tmp.c_str(), b.path.c_str());
+				b.saved = version;
+			} catch (std::runtime_error& e) {
+				fprintf(stderr, "%s: %s\n", tmp.c_str(), e.what());
+			}
+		}
+	}
+}
+
+// with --join-cache, what each backend answers joining players, served
+// from here on the next joins
+std::unordered_map<const net::backend*, std::unique_ptr<net::join_cache>> join_caches;
+
+net::join_cache* join_cache_of(const net::backend* b)
+{
+	auto it = join_caches.find(b);
+	return it == join_caches.end() ? nullptr : it->second.get();
+}
+
+// latency by default, --throughput batches writes for bulk transfers
+net::socket_options sockets = net::socket_options::latency();
+net::flush_mode flushing = net::flush_mode::latency;
+
+// with --interest, updates about entities further than this many pixels
+// from the player are held back
+float interest_radius = 0;
+
+void remap(uint8_t id, std::span<uint8_t> data, uint8_t from, uint8_t to)
+{
+	if (from == to || !slot_ids[id] || data.empty()) {
+		return;
+	}
+	if (data[0] == from) {
+		data[0] = to;
+	} else if (data[0] == to) {
+		data[0] = from;
+	}
+}
+
+// Puts what the client sends in its backend's slots, for every handler
+// registered after it.
+void remap_from_client(session* s)
+{
+	for (int i = 1; i < 255; i++) {
+		if (slot_ids[i]) {
+			s->client.reg_handler(i, [s, i](std::span<uint8_t> data) {
+				remap(i, data, s->slot, s->upstream_slot);
+				return false;
+			});
+		}
+	}
+}
+
+void forward_to_upstream(session* s)
 {
 	for (int i = 1; i < 255; i++) {
-		src.reg_handler(i, [&dst, i](std::span<uint8_t> data) {
-			dst.send_packet(i, data);
+		// what only servers send has no business coming from a client
+		if (!net::packet::info(i).sent_by_client()) {
+			continue;
+		}
+		s->client.reg_handler(i, [s, i](std::span<uint8_t> data) {
+			s->upstream->send_packet(i, data);
 			return true;
 		});
 	}
 }
 
-int main(int argc, char* argv[])
+void forward_to_client(session* s, conn& upstream)
+{
+	for (int i = 1; i < 255; i++) {
+		if (!net::packet::info(i).sent_by_server()) {
+			continue;
+		}
+		upstream.reg_handler(i, [s, i](std::span<uint8_t> data) {
+			remap(i, data, s->upstream_slot, s->slot);
+			s->client.send_packet(i, data);
+			return true;
+		});
+	}
+}
+
+void close_session(net::event_loop& loop, session& s)
+{
+	if (s.closed) {
+		return;
+	}
+	s.closed = true;
+
+	if (s.join_deadline) {
+		loop.cancel_timer(*s.join_deadline);
+	}
+
+	loop.remove(s.client.native_handle());
+	loop.remove(s.upstream->native_handle());
+	stop_feeding(s.backend, *s.upstream);
+	s.client.close();
+	s.upstream->close();
+	if (auto j = std::move(s.joining)) {
+		loop.remove(j->native_handle());
+		j->close();
+	}
+
+	players_of(s.backend).clear(s.upstream_slot);
+	s.backend->players--;
+	live[s.shard_index].erase(&s);
+}
+
+// Stops reading the client while `upstream` can't take more of it, rather
+// than waiting on the socket and stalling the whole shard.
+void throttle(net::event_loop& loop, session& s, conn& upstream, bool full)
+{
+	if (s.closed || s.upstream.get() != &upstream) {
+		return;
+	}
+	s.client.pause_reading(full);
+	loop.modify(s.client.native_handle(), (full ? 0 : EPOLLIN) | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+	if (!full) {
+		s.client.device().notify();
+	}
+}
+
+// Gives up on moving the player, it stays where it is.
+void abort_move(net::event_loop& loop, session& s)
+{
+	s.moving = false;
+	if (auto j = std::move(s.joining)) {
+		loop.remove(j->native_handle());
+		j->close();
+	}
+}
+
+template <class F>
+void watch(net::event_loop& loop, std::shared_ptr<session> s, conn& c, F on_close)
 {
-	auto server = net::client("localhost", 7777);
-	auto proxy = net::server("localhost", 8888);
+	auto on_event = [s, &c, on_close](uint32_t events) {
+		bool alive = true;
+		try {
+			if (events & EPOLLOUT) {
+				alive = c.on_writable();
+			}
+			if (alive && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+				alive = c.on_readable();
+			}
+		} catch (...) {
+			// malformed packet or the other side went away while forwarding
+			alive = false;
+		}
+
+		if (!alive || c.lagging()) {
+			on_close();
+		}
+	};
+	// with --uring data can be waiting in the ring with no socket edge
+	// left to report it, closing `c` drops the callback
+	c.device().on_ready([on_event] { on_event(EPOLLIN | EPOLLOUT); });
+	loop.add(c.native_handle(), EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, on_event);
+}
 
-	proxy.bind();
-	proxy.listen(1);
+void watch(net::event_loop& loop, std::shared_ptr<session> s, conn& c)
+{
+	watch(loop, s, c, [&loop, s = s.get()] { close_session(loop, *s); });
+}
 
-	auto server_conn = server.connect();
-	auto proxy_conn = proxy.accept();
+// Joins the player to `to` by replaying its handshake there, up to spawning,
+// then swaps upstreams. The client gets the new world meanwhile and reloads
+// it, but keeps its slot; packets about the two slots are remapped from then on.
+net::task<> move(net::event_loop& loop, std::shared_ptr<session> s, net::backend& to)
+{
+	using namespace net::packet;
+
+	s->moving = true;
+	auto c = co_await to.client(sockets).connect_async<io::uring_io>(loop, ring_of(s->shard_index, loop));
+	c.set_nonblocking();
+	if (s->closed || !s->moving) {
+		c.close();
+		co_return;
+	}
+	s->joining = std::make_unique<conn>(std::move(c));
+	auto& next = *s->joining;
+	next.set_backpressure(4096, net::backpressure::block, {}, [&loop, s = s.get(), &next](bool full) { throttle(loop, *s, next, full); });
+	next.set_flush_mode(flushing);
+	publish(next, 2 * s->id + 1);
+	next.attach(loop);
+	watch(loop, s, next, [&loop, s = s.get()] { abort_move(loop, *s); });
+	auto gone = [s = s.get(), &next] { return s->closed || s->joining.get() != &next; };
+
+	next.send_packet(conn_request::packet_id, s->join.connect_request());
+	auto accepted = co_await next.expect<net::packet::accept>();
+	if (gone()) {
+		co_return;
+	}
+	auto slot = accepted.client_id;
+
+	if (auto w = world_of(&to)) {
+		// not before the swap, or aborting the move would have to hand it on
+		w->observe(next, true, [s = s.get(), &to, &next] { return s->upstream.get() == &next && feeds(&to, next); });
+	}
+	// until the swap only the new world reaches the client: world_info and
+	// the tile sections (10, and 11 that frames them)
+	static const auto reload = [] {
+		bitset<256> ids {};
+		ids[world_info::packet_id] = true;
+		ids[send_tile_data::packet_id] = true;
+		ids[11] = true;
+		return ids;
+	}();
+	for (int i = 1; i < 255; i++) {
+		if (info(i).sent_by_server()) {
+			next.reg_handler(i, [s = s.get(), &next, i](std::span<uint8_t> data) {
+				if (s->joining.get() != &next) {
+					return false;
+				}
+				if (reload[i]) {
+					s->client.send_packet(i, data);
+				}
+				return true;
+			});
+		}
+	}
+	forward_to_client(s.get(), next);
+	if (interest_radius > 0) {
+		// what's held is about the old world
+		s->client.set_interest(interest_radius, std::chrono::seconds(1));
+	}
+
+	// everything up to request_tiles_at, then the spawn once the server
+	// sent the sections around it
+	auto& table = players_of(&to);
+	auto replay = [&](bool spawn) {
+		s->join.replay(slot, [&](uint8_t id, std::span<uint8_t> payload) {
+			if ((id == spawn_player::packet_id) == spawn) {
+				next.send_packet(id, payload);
+				table.apply(id, payload);
+			}
+		});
+	};
+	replay(false);
+	co_await next.expect<initial_spawn_player>();
+	if (gone()) {
+		co_return;
+	}
+	replay(true);
+	co_await next.expect<connection_completed>();
+	if (gone()) {
+		co_return;
+	}
 
-	uint8_t slot;
-	server_conn.reg_handler<net::packet::accept>([&slot](auto& a) {
-		slot = a.client_id;
+	players_of(s->backend).clear(s->upstream_slot);
+	loop.remove(s->upstream->native_handle());
+	stop_feeding(s->backend, *s->upstream);
+	s->upstream->close();
+	s->upstream = std::move(s->joining);
+	s->upstream_slot = slot;
+	// closing it ends the session from now on, not just the move
+	loop.remove(next.native_handle());
+	watch(loop, s, next);
+	throttle(loop, *s, next, next.congested());
+
+	s->backend->players--;
+	to.players++;
+	s->backend = &to;
+	s->moving = false;
+}
+
+// "/move <backend>" in chat
+void handle_commands(net::event_loop& loop, std::shared_ptr<session> s)
+{
+	s->client.reg_handler<net::packet::chat_message>([&loop, w = std::weak_ptr(s)](net::packet::chat_message& m) {
+		auto& text = m.text;
+		if (!text.starts_with("/move ")) {
+			return false;
+		}
+
+		auto s = w.lock();
+		auto to = backends.find(text.substr(6));
+		if (s && to && to != s->backend && !s->moving && s->join.joined()) {
+			net::spawn(move(loop, s, *to), [&loop, s = s.get()](std::exception_ptr) { abort_move(loop, *s); });
+		}
+		return true;
+	});
+}
+
+// Sets up forwarding between the client and upstream of `s`. A session
+// handed over by another process is already past the join cache, and
+// maybe past the join deadline.
+void run_session(net::shard& shard, std::shared_ptr<session> s, bool resumed = false, bool joining_world = true)
+{
+	s->shard_index = shard.index();
+	live[s->shard_index].insert(s.get());
+
+	// a slow player may lose state updates or get kicked, but never stalls its upstream
+	using namespace net::packet;
+	static const auto droppable = ids_where([](const traits& t) { return t.droppable; });
+	s->client.set_backpressure(4096, net::backpressure::drop_oldest, droppable);
+	// and doesn't get sent the same state over and over
+	static const auto repeated = player_ids<player_health, player_mana, update_player_buffs, player_zones>();
+	s->client.set_dedup(repeated, std::chrono::seconds(1));
+	// nor several updates of the same state per tick
+	static const auto coalesced = ids_where([](const traits& t) { return t.coalesced; });
+	s->client.set_coalesce(coalesced, std::chrono::milliseconds(16));
+	s->client.set_flush_mode(flushing);
+	if (interest_radius > 0) {
+		s->client.set_interest(interest_radius, std::chrono::seconds(1));
+	}
+	auto& loop = shard.events();
+	s->client.attach(loop);
+	auto& upstream = *s->upstream;
+	upstream.attach(loop);
+	upstream.set_backpressure(4096, net::backpressure::block, {}, [&loop, s = s.get(), &upstream](bool full) { throttle(loop, *s, upstream, full); });
+	upstream.set_flush_mode(flushing);
+	publish(s->client, 2 * s->id);
+	publish(upstream, 2 * s->id + 1);
+
+	s->upstream->reg_handler<net::packet::accept>([s = s.get()](auto& a) {
+		s->slot = a.client_id;
+		s->upstream_slot = a.client_id;
 		return false;
 	});
 
-	forward_packets(server_conn, proxy_conn);
-	forward_packets(proxy_conn, server_conn);
+	s->client.set_idle_timeout(std::chrono::seconds(60), [&loop, s = s.get()] { close_session(loop, *s); });
+	if (joining_world) {
+		s->join_deadline = loop.add_timer(std::chrono::seconds(30), [&loop, s = s.get()] {
+			s->join_deadline.reset();
+			close_session(loop, *s);
+		});
+	}
+	s->client.reg_handler(net::packet::request_world_data::packet_id, [&loop, s = s.get()](std::span<uint8_t>) {
+		if (s->join_deadline) {
+			loop.cancel_timer(*s->join_deadline);
+			s->join_deadline.reset();
+		}
+		return false;
+	});
+
+	remap_from_client(s.get());
+	net::player_table::observe_into(s->client, [s = s.get()](uint8_t id) { return id == s->upstream_slot ? &players_of(s->backend) : nullptr; });
+	s->join.observe(s->client);
+	handle_commands(shard.events(), s);
 
-	auto handle_loop = [](net::conn& c) {
-		for (;;) {
-			c.handle();
+	if (auto w = world_of(s->backend)) {
+		w->observe(upstream, true, [b = s->backend, &upstream] { return feeds(b, upstream); });
+	}
+	if (auto cache = join_cache_of(s->backend)) {
+		cache->observe(*s->upstream);
+		if (!resumed) {
+			cache->serve(s->client, *s->upstream);
+		}
+	}
+	// the player's own edits, into the world it's in at the time
+	s->client.reg_handler<net::packet::tile_manipulation>([s = s.get()](auto& m) {
+		if (auto w = world_of(s->backend)) {
+			w->apply(m);
 		}
+		return false;
+	});
+
+	forward_to_client(s.get(), *s->upstream);
+	forward_to_upstream(s.get());
+
+	watch(shard.events(), s, s->client);
+	watch(shard.events(), s, *s->upstream);
+
+	if (resumed) {
+		bool alive;
+		try {
+			alive = s->client.dispatch_restored() && s->upstream->dispatch_restored();
+		} catch (...) {
+			alive = false;
+		}
+		if (!alive) {
+			close_session(shard.events(), *s);
+		}
+	}
+}
+
+net::task<> start_session(net::shard& shard, net::conn accepted)
+{
+	auto* ring = ring_of(shard.index(), shard.events());
+	conn client(io::uring_io(accepted.native_handle(), ring), accepted.address(), sizeof(sockaddr_in));
+	client.set_nonblocking();
+	auto& backend = backends.route(client.address());
+
+	auto& pending = connecting[shard.index()];
+	pending.count++;
+	std::unique_ptr<conn> upstream;
+	try {
+		upstream = std::make_unique<conn>(co_await backend.client(sockets).connect_async<io::uring_io>(shard.events(), ring));
+		upstream->set_nonblocking();
+	} catch (std::runtime_error&) {
+		client.close();
+	}
+	pending.count--;
+
+	std::shared_ptr<session> s;
+	if (upstream) {
+		backend.players++;
+		s = std::make_shared<session>(std::move(client), std::move(upstream), &backend);
+		run_session(shard, s);
+	}
+	if (auto then = pending.then) {
+		then(s.get());
+	}
+}
+
+// What goes over --handoff: every listening socket, then every session.
+// Both processes have to agree on the layout, so upgrades between
+// versions that change it need a full restart.
+enum class handoff_record : uint8_t {
+	listener,
+	// slot, upstream_slot, whether the join deadline is still on, the
+	// backend's name, what's in flight on the client and the upstream, then
+	// the handshake as id, payload pairs up to a 0 id; fds client, upstream
+	session,
+};
+
+void put(std::vector<uint8_t>& out, std::span<const uint8_t> bytes)
+{
+	io::serialized_io(io::buffered_io(out)).write(uint32_t(bytes.size()));
+	out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+// Handing a session off runs the shard's ring, which mustn't call back
+// into `s` meanwhile.
+void quiesce(session& s)
+{
+	s.client.device().on_ready({});
+	s.upstream->device().on_ready({});
+	if (s.joining) {
+		s.joining->device().on_ready({});
+	}
+}
+
+// Sends `s` to the process taking over and closes it here. Runs on the
+// session's shard.
+void hand_off(net::shard& shard, session& s, net::handoff& to)
+{
+	auto& loop = shard.events();
+	abort_move(loop, s);
+	loop.remove(s.client.native_handle());
+	loop.remove(s.upstream->native_handle());
+	auto client = s.client.take_in_flight();
+	auto upstream = s.upstream->take_in_flight();
+
+	std::vector<uint8_t> out;
+	auto w = io::serialized_io(io::buffered_io(out));
+	w.write(uint8_t(handoff_record::session));
+	w.write(s.slot);
+	w.write(s.upstream_slot);
+	w.write(uint8_t(s.join_deadline.has_value()));
+	put(out, std::span(reinterpret_cast<const uint8_t*>(s.backend->name.data()), s.backend->name.size()));
+	put(out, client.rx);
+	put(out, client.tx);
+	put(out, upstream.rx);
+	put(out, upstream.tx);
+	s.join.for_each([&](uint8_t id, std::span<const uint8_t> payload) {
+		w.write(id);
+		put(out, payload);
+	});
+	w.write(uint8_t(0));
+
+	int fds[] = { s.client.native_handle(), s.upstream->native_handle() };
+	try {
+		to.send(out, fds);
+	} catch (std::runtime_error& e) {
+		fprintf(stderr, "handoff: %s\n", e.what());
+	}
+	close_session(loop, s);
+}
+
+conn adopt(int fd, io::uring* ring)
+{
+	sockaddr_in address {};
+	socklen_t size = sizeof(address);
+	getpeername(fd, (sockaddr*)&address, &size);
+	conn c(io::uring_io(fd, ring), address, size);
+	c.set_nonblocking();
+	return c;
+}
+
+// Carries on with a session handed_off() by the previous process.
+void resume_session(net::shard& shard, const net::handoff::record& r)
+{
+	auto* ring = ring_of(shard.index(), shard.events());
+	auto in = io::serialized_io(io::buffered_io(r.data));
+	auto bytes = [&] {
+		uint32_t size = 0;
+		in.read(size);
+		std::vector<uint8_t> b(std::min<size_t>(size, r.data.size()));
+		in.read(b);
+		return b;
 	};
 
-	std::thread server_thread(handle_loop, std::ref(server_conn));
-	std::thread proxy_thread(handle_loop, std::ref(proxy_conn));
+	uint8_t kind = 0, slot = 0, upstream_slot = 0, joining_world = 0;
+	in.read(kind);
+	in.read(slot);
+	in.read(upstream_slot);
+	in.read(joining_world);
+	auto name = bytes();
+	auto backend = backends.find(std::string(name.begin(), name.end()));
+	conn::in_flight client { bytes(), bytes() };
+	conn::in_flight upstream { bytes(), bytes() };
+	net::handshake join;
+	for (uint8_t id = 0; in.read(id) > 0 && id != 0;) {
+		auto payload = bytes();
+		join.record(id, payload);
+	}
 
-	while (1) {
+	if (in.device().truncated() || r.fds.size() != 2 || !backend) {
+		fprintf(stderr, "handoff: dropping a session%s\n", backend ? "" : " of an unknown backend");
+		for (auto fd : r.fds) {
+			close(fd);
+		}
+		return;
+	}
+
+	auto s = std::make_shared<session>(adopt(r.fds[0], ring), std::make_unique<conn>(adopt(r.fds[1], ring)), backend);
+	s->client.restore(std::move(client));
+	s->upstream->restore(std::move(upstream));
+	s->join = std::move(join);
+	s->slot = slot;
+	s->upstream_slot = upstream_slot;
+	backend->players++;
+	run_session(shard, s, true, joining_world);
+}
+
+// Takes the listening sockets of the process being replaced. `next` gets
+// the record after them, if any.
+std::vector<int> take_listeners(net::handoff& from, std::optional<net::handoff::record>& next)
+{
+	std::vector<int> fds;
+	while ((next = from.receive()) && !next->data.empty() && next->data[0] == uint8_t(handoff_record::listener)) {
+		fds.insert(fds.end(), next->fds.begin(), next->fds.end());
+	}
+	return fds;
+}
+
+// Spreads the sessions of the process being replaced over the shards,
+// until it's done.
+void take_sessions(net::runtime& proxy, net::handoff& from, std::optional<net::handoff::record> next)
+{
+	for (size_t i = 0; next; next = from.receive(), i++) {
+		proxy[i % proxy.size()].post([r = std::move(*next)](net::shard& shard) { resume_session(shard, r); });
+	}
+}
+
+// Hands the listening sockets, then every session, over to `to`, and stops
+// the runtime once they're all gone.
+void hand_over(net::runtime& proxy, net::handoff to)
+{
+	for (size_t i = 0; i < proxy.size(); i++) {
+		int fd = proxy[i].listener_handle();
+		to.send(std::vector { uint8_t(handoff_record::listener) }, std::span(&fd, 1));
+	}
+
+	std::latch done(proxy.size());
+	proxy.broadcast([&](net::shard& shard) {
+		shard.stop_accepting();
+		auto sessions = std::vector(live[shard.index()].begin(), live[shard.index()].end());
+		for (auto s : sessions) {
+			quiesce(*s);
+		}
+		for (auto s : sessions) {
+			hand_off(shard, *s, to);
+		}
+
+		// the ones still connecting follow once their upstream is there
+		auto& pending = connecting[shard.index()];
+		if (pending.count == 0) {
+			done.count_down();
+			return;
+		}
+		pending.then = [&shard, &to, &done, &pending](session* s) {
+			if (s) {
+				quiesce(*s);
+				hand_off(shard, *s, to);
+			}
+			if (pending.count == 0) {
+				pending.then = nullptr;
+				done.count_down();
+			}
+		};
+	});
+	done.wait();
+
+	to.finish();
+	proxy.stop();
+}
+
+int main(int argc, char* argv[])
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	// backends as name=host:port
+	std::vector<std::pair<std::string, std::string>> world_files;
+	bool cache_joins = false;
+	std::string profile_path;
+	uint32_t profile_every = 1000;
+	std::string handoff_path;
+	int snapshot_every = 0;
+	bool use_uring = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--throughput") {
+			sockets = net::socket_options::throughput();
+			flushing = net::flush_mode::throughput;
+			continue;
+		}
+		if (arg == "--world" && i + 1 < argc) {
+			// name=file.wld
+			std::string world = argv[++i];
+			auto eq = world.find('=');
+			if (eq == std::string::npos) {
+				fprintf(stderr, "--world takes backend=file.wld\n");
+				return 1;
+			}
+			world_files.emplace_back(world.substr(0, eq), world.substr(eq + 1));
+			continue;
+		}
+		if (arg == "--interest" && i + 1 < argc) {
+			// in tiles
+			interest_radius = std::stof(argv[++i]) * 16;
+			continue;
+		}
+		if (arg == "--uring") {
+			use_uring = true;
+			continue;
+		}
+		if (arg == "--join-cache") {
+			cache_joins = true;
+			continue;
+		}
+		if (arg == "--profile" && i + 1 < argc) {
+			profile_path = argv[++i];
+			continue;
+		}
+		if (arg == "--profile-every" && i + 1 < argc) {
+			profile_every = std::max(std::stoi(argv[++i]), 1);
+			continue;
+		}
+		if (arg == "--snapshot-every" && i + 1 < argc) {
+			// seconds
+			snapshot_every = std::max(std::stoi(argv[++i]), 1);
+			continue;
+		}
+		if (arg == "--handoff" && i + 1 < argc) {
+			handoff_path = argv[++i];
+			continue;
+		}
+		if (arg == "--stream") {
+			stream = std::make_unique<net::packet_stream>();
+			fprintf(stderr, "packet stream at %s\n", stream->path().c_str());
+			continue;
+		}
+		auto eq = arg.find('=');
+		auto colon = arg.rfind(':');
+		if (eq == std::string::npos || colon == std::string::npos || colon < eq) {
+			fprintf(stderr, "usage: %s [--throughput] [--uring] [--stream] [--interest tiles] [--join-cache] [--handoff socket] [--profile out.folded [--profile-every n]] [--world name=file.wld ... [--snapshot-every seconds]] [name=host:port ...]\n", argv[0]);
+			return 1;
+		}
+		backends.add(arg.substr(0, eq), arg.substr(eq + 1, colon - eq - 1), std::stoi(arg.substr(colon + 1)));
+	}
+	if (backends.size() == 0) {
+		backends.add("main", "127.0.0.1", 7777);
+	}
+	for (size_t i = 0; i < backends.size(); i++) {
+		players[&backends.at(i)] = std::make_unique<net::player_table>();
+	}
+
+	// stopped and joined on the way out of main, before the mirrors they
+	// read are destroyed
+	std::jthread saving, profiling;
+
+	std::vector<backup> backups;
+	for (auto& [name, file] : world_files) {
+		auto b = backends.find(name);
+		if (!b) {
+			fprintf(stderr, "no backend named %s\n", name.c_str());
+			return 1;
+		}
+		try {
+			file::world w(file);
+			worlds[b] = std::make_unique<net::world_mirror>(w);
+			feeders[b] = nullptr;
+			backups.push_back({ worlds[b].get(), file + ".snapshot", w.name(), w.id(), w.importance() });
+		} catch (std::runtime_error& e) {
+			fprintf(stderr, "%s: %s\n", file.c_str(), e.what());
+			return 1;
+		}
+	}
+	if (snapshot_every > 0 && !backups.empty()) {
+		saving = std::jthread(save_snapshots, std::move(backups), std::chrono::seconds(snapshot_every));
+	}
+
+	if (cache_joins) {
+		for (size_t i = 0; i < backends.size(); i++) {
+			join_caches[&backends.at(i)] = std::make_unique<net::join_cache>();
+		}
+	}
+
+	if (!profile_path.empty()) {
+		profile::enable(profile_every);
+		profiling = std::jthread(dump_profile, profile_path);
+	}
+
+	// with --handoff, a proxy already running there hands everything over
+	// to this one and exits
+	std::optional<net::handoff> previous;
+	std::optional<net::handoff::record> next;
+	std::vector<int> inherited;
+	if (!handoff_path.empty()) {
+		try {
+			previous.emplace(net::handoff::connect(handoff_path));
+			inherited = take_listeners(*previous, next);
+		} catch (std::runtime_error&) {
+			// nothing to take over
+			previous.reset();
+		}
+	}
+
+	auto proxy = net::runtime("localhost", 8888, std::thread::hardware_concurrency(), sockets, inherited);
+	live.resize(proxy.size());
+	connecting.resize(proxy.size());
+	if (use_uring) {
+		if (io::uring::supported()) {
+			rings.resize(proxy.size());
+		} else {
+			fprintf(stderr, "io_uring unavailable, using epoll\n");
+		}
+	}
+	proxy.run([](net::shard& shard, net::conn client) { net::spawn(start_session(shard, std::move(client))); });
+
+	std::optional<net::handoff_listener> successor;
+	std::thread handing;
+	if (!handoff_path.empty()) {
+		if (previous) {
+			try {
+				take_sessions(proxy, *previous, std::move(next));
+			} catch (std::runtime_error& e) {
+				fprintf(stderr, "handoff: %s\n", e.what());
+			}
+			previous.reset();
+		}
+		try {
+			successor.emplace(handoff_path);
+		} catch (std::runtime_error& e) {
+			fprintf(stderr, "%s: %s\n", handoff_path.c_str(), e.what());
+			return 1;
+		}
+		handing = std::thread([&] { hand_over(proxy, successor->accept()); });
+	}
+	proxy.join();
+	if (handing.joinable()) {
+		handing.join();
 	}
 
 	return 0;
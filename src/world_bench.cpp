@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "file/tile.hpp"
+#include "file/world.hpp"
+#include "net/world_mirror.hpp"
+#include "util/profile.hpp"
+
+// Times the world pipeline on the given .wld files (see world_gen), one
+// line per measurement so runs can be diffed. Exits non-zero if a world
+// doesn't read back the same after being saved.
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// Best of `runs` calls of `f`, in seconds.
+template <class F>
+double best_of(int runs, F f)
+{
+	auto best = std::chrono::duration<double>::max();
+	for (int i = 0; i < runs; i++) {
+		auto start = clock_type::now();
+		f();
+		best = std::min<std::chrono::duration<double>>(best, clock_type::now() - start);
+	}
+	return best.count();
+}
+
+long peak_rss_kb()
+{
+	rusage usage {};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+bool same(const file::tiles& a, const file::tiles& b)
+{
+	if (a.width() != b.width() || a.height() != b.height()) {
+		return false;
+	}
+	for (int32_t x = 0; x < a.width(); x++) {
+		for (int32_t y = 0; y < a.height(); y++) {
+			if (!(a.at(x, y) == b.at(x, y))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Longest a stream of tile edits to `m` waited while `f` ran, in seconds.
+template <class F>
+double max_stall(net::world_mirror& m, F f)
+{
+	std::atomic<bool> done = false;
+	double worst = 0;
+	std::jthread editor([&] {
+		net::packet::tile_manipulation edit { net::packet::tile_manipulation::place_tile, 0, 0, 1, 0 };
+		for (int32_t i = 0; !done; i++) {
+			edit.x = i * 7919 % m.width();
+			edit.y = i * 104729 % m.height();
+			auto start = clock_type::now();
+			m.apply(edit);
+			worst = std::max(worst, std::chrono::duration<double>(clock_type::now() - start).count());
+		}
+	});
+	f();
+	done = true;
+	editor.join();
+	return worst;
+}
+
+bool bench(const std::string& path, int runs, unsigned threads)
+{
+	auto name = std::filesystem::path(path).filename().string();
+	auto file_mb = std::filesystem::file_size(path) / 1e6;
+
+	auto header = best_of(runs * 20, [&] { file::world w(path); });
+	printf("%s header_parse_us %.1f\n", name.c_str(), header * 1e6);
+
+	file::world w(path);
+	auto mtiles = double(w.width()) * w.height() / 1e6;
+
+	file::tiles grid;
+	auto load = best_of(runs, [&] { grid = w.load_tiles(); });
+	printf("%s load_ms %.1f\n", name.c_str(), load * 1e3);
+	printf("%s load_mtiles_per_s %.1f\n", name.c_str(), mtiles / load);
+	printf("%s load_mb_per_s %.1f\n", name.c_str(), file_mb / load);
+
+	// one load per thread at once, as shards mirroring several worlds would
+	auto parallel = best_of(runs, [&] {
+		std::vector<std::jthread> loaders;
+		for (unsigned i = 0; i < threads; i++) {
+			loaders.emplace_back([&w] { w.load_tiles(); });
+		}
+	});
+	printf("%s parallel_load_threads %u\n", name.c_str(), threads);
+	printf("%s parallel_load_mtiles_per_s %.1f\n", name.c_str(), mtiles * threads / parallel);
+
+	printf("%s file_mb %.1f\n", name.c_str(), file_mb);
+	printf("%s tiles_mb %.1f\n", name.c_str(), double(w.width()) * w.height() * sizeof(file::tile) / 1e6);
+	printf("%s peak_rss_mb %.1f\n", name.c_str(), peak_rss_kb() / 1e3);
+
+	auto copy = path + ".bench";
+	auto save = best_of(runs, [&] { file::world::save(copy, w.name(), w.id(), grid, w.importance()); });
+	printf("%s save_ms %.1f\n", name.c_str(), save * 1e3);
+	printf("%s save_mb_per_s %.1f\n", name.c_str(), std::filesystem::file_size(copy) / 1e6 / save);
+
+	auto ok = same(grid, file::world(copy).load_tiles());
+	std::filesystem::remove(copy);
+
+	// backups of a mirror taking edits: a chunk by chunk snapshot against
+	// copying the whole world in one go
+	net::world_mirror mirror(w);
+	auto snapshot = best_of(runs, [&] { mirror.snapshot(); });
+	printf("%s snapshot_ms %.1f\n", name.c_str(), snapshot * 1e3);
+	printf("%s snapshot_max_stall_us %.0f\n", name.c_str(), max_stall(mirror, [&] { mirror.snapshot(); }) * 1e6);
+	printf("%s locked_copy_max_stall_us %.0f\n", name.c_str(), max_stall(mirror, [&] { mirror.read([](const file::tiles& t) { return t; }); }) * 1e6);
+	if (!ok) {
+		fprintf(stderr, "%s: saved world reads back different\n", path.c_str());
+	}
+	return ok;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int runs = 3;
+	unsigned threads = std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+	std::vector<std::string> paths;
+	std::string profile_path;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--runs" && i + 1 < argc) {
+			runs = std::max(std::stoi(argv[++i]), 1);
+		} else if (arg == "--profile" && i + 1 < argc) {
+			profile_path = argv[++i];
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = std::max(std::stoi(argv[++i]), 1);
+		} else {
+			paths.push_back(arg);
+		}
+	}
+	if (paths.empty()) {
+		fprintf(stderr, "usage: %s [--runs n] [--threads n] [--profile out.folded] world.wld ...\n", argv[0]);
+		return 1;
+	}
+
+	if (!profile_path.empty()) {
+		profile::enable(1);
+	}
+
+	bool ok = true;
+	for (auto& path : paths) {
+		try {
+			ok &= bench(path, runs, threads);
+		} catch (std::runtime_error& e) {
+			fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+			ok = false;
+		}
+	}
+
+	if (!profile_path.empty()) {
+		if (auto out = fopen(profile_path.c_str(), "w")) {
+			profile::write_folded(out);
+			fclose(out);
+		}
+	}
+	return ok ? 0 : 1;
+}
\ No newline at end of file
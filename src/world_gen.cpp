@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "file/tile.hpp"
+#include "file/world.hpp"
+
+// Writes synthetic worlds of the sizes Terraria makes, with roughly the
+// tile mix of a fresh one: sky, grass and trees on a rolling surface, dirt
+// then stone with ore veins and caves, walls and water underground, ash
+// and lava at the bottom. Not playable, but realistic enough to benchmark
+// file::world on.
+
+namespace {
+
+namespace tile_id {
+constexpr uint16_t dirt = 0;
+constexpr uint16_t stone = 1;
+constexpr uint16_t grass = 2;
+constexpr uint16_t torch = 4;
+constexpr uint16_t tree = 5;
+constexpr uint16_t iron = 6;
+constexpr uint16_t copper = 7;
+constexpr uint16_t gold = 8;
+constexpr uint16_t silver = 9;
+constexpr uint16_t pot = 28;
+constexpr uint16_t clay = 40;
+constexpr uint16_t sand = 53;
+constexpr uint16_t ash = 57;
+constexpr uint16_t hellstone = 58;
+constexpr uint16_t count = 693;
+}
+
+namespace wall_id {
+constexpr uint16_t stone = 1;
+constexpr uint16_t dirt = 2;
+}
+
+struct size {
+	const char* name;
+	int32_t width;
+	int32_t height;
+};
+
+constexpr size sizes[] = {
+	{ "small", 4200, 1200 },
+	{ "medium", 6400, 1800 },
+	{ "large", 8400, 2400 },
+};
+
+file::tile_importance importance()
+{
+	file::tile_importance imp;
+	imp.resize(bits_ceil(tile_id::count));
+	imp[tile_id::torch] = true;
+	imp[tile_id::pot] = true;
+	return imp;
+}
+
+class generator {
+	file::tiles grid;
+	std::mt19937 rng;
+	std::vector<int32_t> surface;
+	int32_t rock;
+	int32_t hell;
+
+	int32_t uniform(int32_t lo, int32_t hi) { return std::uniform_int_distribution<int32_t>(lo, hi)(rng); }
+	bool chance(double p) { return std::bernoulli_distribution(p)(rng); }
+
+	void block(int32_t x, int32_t y, uint16_t type)
+	{
+		auto& t = grid.at(x, y);
+		t.type = type;
+		t.set(file::tile::active, true);
+	}
+
+	template <class F>
+	void disc(int32_t cx, int32_t cy, int32_t r, F f)
+	{
+		for (auto x = std::max(cx - r, 0); x <= std::min(cx + r, grid.width() - 1); x++) {
+			for (auto y = std::max(cy - r, 0); y <= std::min(cy + r, grid.height() - 1); y++) {
+				if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r) {
+					f(grid.at(x, y), x, y);
+				}
+			}
+		}
+	}
+
+	void terrain()
+	{
+		// rolling hills around a third of the way down
+		double h = grid.height() * 0.3, slope = 0;
+		for (int32_t x = 0; x < grid.width(); x++) {
+			slope = std::clamp(slope + std::normal_distribution(0.0, 0.15)(rng), -1.0, 1.0);
+			h = std::clamp(h + slope, grid.height() * 0.2, grid.height() * 0.38);
+			surface[x] = int32_t(h);
+		}
+
+		for (int32_t x = 0; x < grid.width(); x++) {
+			for (int32_t y = surface[x]; y < grid.height(); y++) {
+				block(x, y, y < rock ? tile_id::dirt : y < hell ? tile_id::stone : tile_id::ash);
+				if (y > surface[x] + 4 && y < hell) {
+					grid.at(x, y).wall = y < rock ? wall_id::dirt : wall_id::stone;
+				}
+			}
+			block(x, surface[x], tile_id::grass);
+		}
+	}
+
+	// stone in the dirt, dirt, clay and sand in the stone
+	void patches()
+	{
+		auto area = int64_t(grid.width()) * grid.height();
+		for (int64_t i = 0; i < area / 800; i++) {
+			auto x = uniform(0, grid.width() - 1), y = uniform(surface[x] + 6, hell - 1);
+			auto type = y < rock ? tile_id::stone : std::array { tile_id::dirt, tile_id::clay, tile_id::sand }[uniform(0, 2)];
+			disc(x, y, uniform(3, 9), [&](file::tile& t, int32_t, int32_t) {
+				if (t.has(file::tile::active) && t.type != tile_id::grass) {
+					t.type = type;
+				}
+			});
+		}
+	}
+
+	void ores()
+	{
+		auto area = int64_t(grid.width()) * grid.height();
+		for (int64_t i = 0; i < area / 1200; i++) {
+			auto x = uniform(0, grid.width() - 1), y = uniform(surface[x] + 10, hell - 1);
+			// the deeper, the better the ore
+			auto depth = double(y - surface[x]) / (hell - surface[x]);
+			auto type = depth < 0.25 ? tile_id::copper : depth < 0.5 ? tile_id::iron : depth < 0.75 ? tile_id::silver : tile_id::gold;
+			disc(x, y, uniform(1, 3), [&](file::tile& t, int32_t, int32_t) {
+				if (t.has(file::tile::active)) {
+					t.type = type;
+				}
+			});
+		}
+	}
+
+	// worms of air, with water pooling at their bottom and the odd torch or pot
+	void caves()
+	{
+		auto area = int64_t(grid.width()) * grid.height();
+		for (int64_t i = 0; i < area / 8000; i++) {
+			double x = uniform(0, grid.width() - 1), y = uniform(rock - 100, hell - 20);
+			double angle = std::uniform_real_distribution(0.0, 6.28)(rng);
+			auto r = uniform(2, 6);
+			for (int32_t step = uniform(30, 200); step > 0; step--) {
+				disc(int32_t(x), int32_t(y), r, [](file::tile& t, int32_t, int32_t) {
+					t.type = 0;
+					t.frame_x = t.frame_y = -1;
+					t.set(file::tile::active, false);
+				});
+				angle += std::normal_distribution(0.0, 0.3)(rng);
+				x += std::cos(angle) * r * 0.6;
+				y += std::sin(angle) * r * 0.4;
+				if (x < 0 || x >= grid.width() || y < 0 || y >= hell) {
+					break;
+				}
+			}
+
+			auto floor = int32_t(y) + r;
+			if (floor + 1 < hell && x >= 0 && x < grid.width()) {
+				auto cx = int32_t(x);
+				auto liquid = chance(0.4);
+				for (auto px = std::max(cx - r, 0); px <= std::min(cx + r, grid.width() - 1); px++) {
+					auto& above = grid.at(px, floor - 1);
+					if (above.has(file::tile::active)) {
+						continue;
+					}
+					if (liquid) {
+						above.liquid = 255;
+						above.liquid_type = file::tile::water;
+					} else if (chance(0.05)) {
+						block(px, floor - 1, tile_id::pot);
+						above.frame_x = 18 * uniform(0, 1);
+						above.frame_y = 36 * uniform(0, 3);
+					} else if (chance(0.02)) {
+						block(px, floor - 1, tile_id::torch);
+						above.frame_x = 0;
+						above.frame_y = 0;
+					}
+				}
+			}
+		}
+	}
+
+	void trees()
+	{
+		for (int32_t x = 2; x < grid.width() - 2; x += uniform(4, 12)) {
+			if (!chance(0.6)) {
+				continue;
+			}
+			auto top = std::max(surface[x] - uniform(6, 16), 1);
+			for (auto y = top; y < surface[x]; y++) {
+				if (!grid.at(x, y).has(file::tile::active)) {
+					block(x, y, tile_id::tree);
+				}
+			}
+		}
+	}
+
+	void underworld()
+	{
+		for (int32_t x = 0; x < grid.width(); x++) {
+			auto ceiling = hell + 40 + int32_t(std::sin(x / 40.0) * 10);
+			auto lake = grid.height() - 40 + int32_t(std::sin(x / 90.0) * 15);
+			for (auto y = ceiling; y < grid.height() - 1; y++) {
+				auto& t = grid.at(x, y);
+				if (y < lake) {
+					t = {};
+				} else if (y == lake) {
+					t = {};
+					t.liquid = 255;
+					t.liquid_type = file::tile::lava;
+				} else if (chance(0.03)) {
+					t.type = tile_id::hellstone;
+				}
+			}
+		}
+	}
+
+public:
+	generator(int32_t width, int32_t height, uint32_t seed)
+	    : grid(width, height)
+	    , rng(seed)
+	    , surface(width)
+	    , rock(height * 0.4)
+	    , hell(height - 200)
+	{
+	}
+
+	file::tiles run()
+	{
+		terrain();
+		patches();
+		ores();
+		caves();
+		trees();
+		underworld();
+		return std::move(grid);
+	}
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s small|medium|large|WIDTHxHEIGHT out.wld [seed]\n", argv[0]);
+		return 1;
+	}
+
+	std::string kind = argv[1];
+	int32_t width = 0, height = 0;
+	for (auto& s : sizes) {
+		if (kind == s.name) {
+			width = s.width;
+			height = s.height;
+		}
+	}
+	if (width == 0 && (sscanf(argv[1], "%dx%d", &width, &height) != 2 || width < 1 || height < 300)) {
+		fprintf(stderr, "unknown world size %s\n", argv[1]);
+		return 1;
+	}
+	uint32_t seed = argc > 3 ? std::stoul(argv[3]) : 1;
+
+	try {
+		auto grid = generator(width, height, seed).run();
+		file::world::save(argv[2], "bench " + kind, seed, grid, importance());
+	} catch (std::runtime_error& e) {
+		fprintf(stderr, "%s: %s\n", argv[2], e.what());
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file